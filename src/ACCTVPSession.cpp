@@ -0,0 +1,573 @@
+//  Plane Projection
+//  ACCTVPSession.cpp
+//
+//  University of Bristol
+//
+//  Created by Henrique Grandinetti on 13/07/15.
+//  henriquegrandinetti@gmail.com
+
+#include "ACCTVPSession.h"
+#include "geometry.h"
+#include "ingest.h"
+
+#include "opencv2/imgproc/imgproc.hpp"
+
+#include <algorithm>
+#include <float.h>
+
+sessionParams defaultSessionParams(){
+    sessionParams params;
+
+    params.detection.numVps = 2;
+    params.detection.houghThreshold = 120;
+    params.detection.detector = DETECTOR_HOUGH;
+    params.detection.estimator = ESTIMATOR_GREEDY;
+    params.detection.scale = 1;
+    params.detection.tileThreshold = 0;
+    params.detection.tiles = 0;
+    params.detection.shapes = 0;
+    params.detection.mergeSegments = true;
+
+    params.procWidth = -1;
+    params.detectWidth = -1;
+    params.still = false;
+    params.numFramesCalib = 40;
+    params.stillTolerance = 0.05f;
+    params.numFramesSmooth = 30;
+    params.fixedFocal = false;
+    params.focal = -1;
+    params.topSize = Size(-1, -1);
+    params.gsd = 0;
+    params.crop = Rect_<float>();
+    params.distFocal = -1;
+    params.overlay = OVERLAY_NONE;
+    params.topImage = false;
+    params.groundLUTStep = 0;
+    params.staticThreshold = 0;
+    params.staticTopThreshold = 0;
+
+    return params;
+}
+
+//Mat header over a caller buffer, I420 buffers are a single channel image 3/2 the frame height
+Mat wrapFrameBuffer(const frameBuffer &buffer){
+    if (buffer.format == FRAME_BGR)
+        return Mat(buffer.height, buffer.width, CV_8UC3, buffer.data, buffer.stride);
+    if (buffer.format == FRAME_I420)
+        return Mat(buffer.height*3/2, buffer.width, CV_8UC1, buffer.data, buffer.stride);
+
+    return Mat(buffer.height, buffer.width, CV_8UC1, buffer.data, buffer.stride);
+}
+
+//buffer over a decoded frame, a single channel image 3/2 the frame height is taken as I420
+frameBuffer matFrameBuffer(const Mat &img, Size frameSize){
+    frameBuffer buffer;
+    buffer.data = img.data;
+    buffer.stride = img.step;
+    buffer.width = frameSize.width;
+    buffer.height = frameSize.height;
+
+    if (img.type() == CV_8UC1 && img.cols == frameSize.width && img.rows == frameSize.height*3/2)
+        buffer.format = FRAME_I420;
+    else
+        buffer.format = img.channels() == 3 ? FRAME_BGR : FRAME_GRAY;
+
+    return buffer;
+}
+
+ACCTVPSession::ACCTVPSession(const sessionParams &p, mouseDataCrop *c){
+    params = p;
+    crop = c ? c : &ownCrop;
+    params.detection.tiles = &segmentTiles;
+    params.detection.shapes = params.overlay > OVERLAY_NONE ? &shapes : 0;
+    overlayAxis = false;
+    inPlace = false;
+    frameSize = Size(0, 0);
+    fixedVP = false;
+    topGenerated = false;
+    if (params.crop.area() > 0)
+        crop->ground = params.crop;
+    lockedFocal = params.fixedFocal && params.focal > 0 ? params.focal : 0;
+
+    reset();
+}
+
+//drops the calibration, the next frame starts a new one
+void ACCTVPSession::reset(){
+    vpVector.clear();
+    stillVPS.clear();
+    stillFrames = 0;
+    stillCompleted = false;
+    stillATA[0].release();
+    stillATA[1].release();
+    stillLines[0] = stillLines[1] = 0;
+    stillStable = 0;
+    detectThumb.release();
+    topThumb.release();
+    vp = Vec4f(-1, -1, -1, -1);
+    hasPrevious = false;
+}
+
+//vanishing points given by the caller, in frame pixels, e.g. from manual calibration or a calibration track.
+//(-1, -1, -1, -1) gives no top-view until other points are set, without running the detection
+void ACCTVPSession::setVanishingPoints(Vec4f vps){
+    fixedVPs = vps;
+    fixedVP = true;
+}
+
+//processing size frame, its luma plane for I420 frames
+Mat ACCTVPSession::frame(){
+    return lumaImg;
+}
+
+//frame with the overlay of params.overlay, drawn on a copy of the frame when first asked for, empty for OVERLAY_NONE
+Mat ACCTVPSession::overlayImage(){
+    if (outputImg.empty() && params.overlay > OVERLAY_NONE && !inputImg.empty()) {
+        if (inputFormat == FRAME_I420)
+            cvtColor(inputImg, outputImg, CV_YUV2BGR_I420);
+        else if (inputImg.channels() == 3)
+            inputImg.copyTo(outputImg);
+        else
+            cvtColor(inputImg, outputImg, CV_GRAY2BGR);
+
+        drawOverlay(outputImg, shapes, params.overlay, 1);
+        if (overlayAxis)
+            tv->drawAxis(outputImg, Point(0,0));
+    }
+
+    return outputImg;
+}
+
+//what the overlay of the last frame draws, in processing size pixels, to be drawn with drawOverlay on e.g. a preview
+const overlayShapes &ACCTVPSession::overlay(){
+    return shapes;
+}
+
+//line detection parameters as set up for the current frame size (scale, camera matrix), e.g. for manual calibration on frame()
+const detectionParams &ACCTVPSession::detection(){
+    return params.detection;
+}
+
+//top-view of the last frame with valid vanishing points, for plane measurements and cropping
+Ptr<TopView> ACCTVPSession::topView(){
+    return tv;
+}
+
+/* ----------------------------------------
+calibrates on one frame and, when a buffer is
+given, writes the top-view into it at its
+size. The result is in frame pixels.
+-------------------------------------------*/
+bool ACCTVPSession::processFrame(const frameBuffer &frame, sessionResult &result, frameBuffer *topView){
+    result.valid = false;
+    result.stillCompleted = false;
+    result.stillFrames = 0;
+    result.detectionSkipped = false;
+    result.topViewReused = false;
+
+    shapes.lines.clear();
+    shapes.clusters.clear();
+    shapes.vps.clear();
+    overlayAxis = false;
+
+    if (!frame.data || frame.width <= 0 || frame.height <= 0)
+        return false;
+
+    if (frame.width != frameSize.width || frame.height != frameSize.height)
+        configure(frame);
+
+    ingest(frame);
+
+    //thumbnail of the detection image, for the unchanged frame checks
+    thumb.release();
+    if (params.staticThreshold > 0 || params.staticTopThreshold > 0)
+        resize(imgGRAY, thumb, Size(STATIC_THUMB_WIDTH, std::max(1, imgGRAY.rows*STATIC_THUMB_WIDTH/imgGRAY.cols)), 0, 0, INTER_AREA);
+
+    if (!calibrate(result))
+        return false;
+
+    //unchanged frame with the same vanishing points, the last top-view still holds
+    bool needImage = (topView && topView->data) || params.topImage;
+    bool reuse = params.staticTopThreshold > 0 && !tv.empty() && vp == topVP && (topGenerated || !needImage)
+                 && crop->ground == topCrop && thumbDifference(topThumb) < params.staticTopThreshold;
+
+    float scale = (float)procSize.width/frameSize.width;
+
+    if (!reuse) {
+        Point2f Fu(vp[0], vp[1]);
+        Point2f Fv(vp[2], vp[3]);
+
+        //a top-view kept for the next frames would read the caller's buffer after it changed, it gets its own copy
+        bool copy = inPlace && params.staticTopThreshold > 0;
+        tv = new TopView(copy ? lumaImg.clone() : lumaImg, Fu, Fv, crop);
+
+        //the lens doesn't change, the vanishing points only give the rotation
+        if (params.fixedFocal) {
+            if (lockedFocal > 0)
+                tv->setFocal(lockedFocal*scale);
+            else
+                lockFocal(tv->getFocal()/scale);
+        }
+
+        if (topView && topView->data)
+            tv->setOutputSize(Size(topView->width, topView->height));
+        else {
+            if (params.topSize.width > 0 && params.topSize.height > 0)
+                tv->setOutputSize(params.topSize);
+            if (params.gsd > 0)
+                tv->setGroundSampling(params.gsd);
+        }
+
+        if (!params.distCoeffs.empty())
+            tv->setDistortion(params.distCoeffs, params.detection.cameraMatrix.at<float>(0,0), &undistortCache);
+        if (!chromaU.empty())
+            tv->setChroma(copy ? chromaU.clone() : chromaU, copy ? chromaV.clone() : chromaV);
+        if (params.groundLUTStep > 0)
+            tv->setGroundLUT(params.groundLUTStep, &groundTable);
+
+        if (needImage) {
+            tv->setTopBuffer(topBuffer);
+            tv->generateTopImage();
+            topBuffer = tv->topImageI420.empty() ? tv->topImage : tv->topImageI420;
+        }
+        else
+            tv->computeTransformation();
+
+        topVP = vp;
+        topGenerated = needImage;
+        topCrop = crop->ground;
+        thumb.copyTo(topThumb);
+    }
+    result.topViewReused = reuse;
+
+    if (params.overlay > OVERLAY_NONE) {
+        shapes.vps.push_back(Point2f(vp[0], vp[1]));
+        shapes.vps.push_back(Point2f(vp[2], vp[3]));
+        overlayAxis = true;
+    }
+
+    if (topView && topView->data && !copyTopView(*topView))
+        return false;
+
+    //back from processing to frame pixels
+    Matx33d toProc(scale, 0, 0, 0, scale, 0, 0, 0, 1);
+    Mat H = tv->getTransformation() * Mat(toProc);
+
+    result.valid = true;
+    result.vps = vp * (1/scale);
+    result.focal = tv->getFocal()/scale;
+    result.rotation = tv->getRotation();
+    result.homography = Matx33d(H.ptr<double>());
+    result.topSize = tv->getTopSize();
+
+    return true;
+}
+
+//sizes and MSAC set-up for a new frame size
+void ACCTVPSession::configure(const frameBuffer &frame){
+    frameSize = Size(frame.width, frame.height);
+
+    if (params.procWidth > 0)
+        procSize = Size(params.procWidth, (int)(frame.height*((double)params.procWidth/frame.width)));
+    else
+        procSize = frameSize;
+
+    //planar 4:2:0 planes are resized separately
+    if (frame.format == FRAME_I420 && params.distCoeffs.empty())
+        procSize = Size(procSize.width & ~1, procSize.height & ~1);
+
+    params.detection.scale = 1;
+    if (params.detectWidth > 0 && params.detectWidth < procSize.width) {
+        detectSize = Size(params.detectWidth, (int)(procSize.height*((double)params.detectWidth/procSize.width)));
+        params.detection.scale = (float)procSize.width/params.detectWidth;
+    }
+    else
+        detectSize = procSize;
+
+    //lens distortion, in processing size pixels
+    if (!params.distCoeffs.empty()) {
+        float focal = (params.distFocal > 0 ? params.distFocal : frame.width) * (float)procSize.width/frame.width;
+
+        params.detection.distCoeffs = params.distCoeffs;
+        params.detection.cameraMatrix = Mat(Matx33f(focal, 0, procSize.width/2, 0, focal, procSize.height/2, 0, 0, 1));
+    }
+
+    msac.init(procSize);
+    if (lockedFocal > 0)
+        msac.setFocal(lockedFocal*procSize.width/frameSize.width);
+    reset();
+}
+
+//processing size frame and grayscale detection image, read in place when no resize is needed
+void ACCTVPSession::ingest(const frameBuffer &frame){
+    Mat src = wrapFrameBuffer(frame);
+    int format = frame.format;
+
+    //the undistorting warp samples BGR only
+    if (format == FRAME_I420 && !params.distCoeffs.empty()) {
+        Mat bgr;
+        cvtColor(src, bgr, CV_YUV2BGR_I420);
+        src = bgr;
+        format = FRAME_BGR;
+    }
+
+    chromaU.release();
+    chromaV.release();
+    const uchar *buffer = src.data;
+
+    if (format == FRAME_I420) {
+        ingestI420(src, procSize, detectSize, inputImg, imgGRAY);
+        splitI420(inputImg, lumaImg, chromaU, chromaV);
+    }
+    else {
+        ingestFrame(src, procSize, detectSize, inputImg, imgGRAY);
+        lumaImg = inputImg;
+    }
+
+    //no resize or conversion, the frame is the caller's buffer
+    inPlace = inputImg.data == buffer && buffer == frame.data;
+
+    //overlays are drawn on a copy of the frame, only if it is asked for
+    inputFormat = format;
+    outputImg.release();
+}
+
+/* ----------------------------------------
+vanishing points of the current frame: fixed,
+averaged over the first frames of a still
+camera or smoothed over the last frames.
+-------------------------------------------*/
+bool ACCTVPSession::calibrate(sessionResult &result){
+    if (fixedVP) {
+        if (!validVPS(fixedVPs))
+            return false;
+        vp = fixedVPs * ((float)procSize.width/frameSize.width);
+        return true;
+    }
+
+    //still camera
+    if (params.still) {
+        if (!stillCompleted) {
+            vp = automaticCalibration(msac, params.detection, imgGRAY, outputImg);
+
+            bool converged = false;
+            if (validVPS(vp)) {
+                stillVPS.push_back(vp);
+                converged = poolStill();
+            }
+
+            //pooled vp, or the average vp if the pooling gave none, kept from now on
+            if (++stillFrames >= params.numFramesCalib || converged) {
+                vp = pooledStillVPs();
+                if (!validVPS(vp) && !stillVPS.empty()) {
+                    vp = Vec4f(0, 0, 0, 0);
+                    for (size_t i = 0; i < stillVPS.size(); i++)
+                        vp += stillVPS[i];
+                    vp /= (int)stillVPS.size();
+                }
+
+                stillCompleted = true;
+                result.stillCompleted = true;
+                result.stillFrames = stillFrames;
+            }
+        }
+    }
+
+    //automatic calibration
+    else {
+        //unchanged frame, the last vanishing points still hold
+        if (hasPrevious && validVPS(previousVP) && params.staticThreshold > 0 && thumbDifference(detectThumb) < params.staticThreshold) {
+            vp = previousVP;
+            result.detectionSkipped = true;
+            return true;
+        }
+
+        vp = automaticCalibration(msac, params.detection, imgGRAY, outputImg);
+        thumb.copyTo(detectThumb);
+
+        //smooth vp position
+        if ((int)vpVector.size() < params.numFramesSmooth)
+            vpVector.push_back(vp);
+        else {
+            vpVector.erase(vpVector.begin());
+            vpVector.push_back(vp);
+
+            Vec4f averageVP(0, 0, 0, 0);
+            for (size_t i = 0; i < vpVector.size(); i++)
+                averageVP += vpVector[i];
+            averageVP /= (int)vpVector.size();
+            vp = averageVP;
+        }
+    }
+
+    //avoid vps to swap position
+    if (hasPrevious &&
+        pointDistance(Point2f(previousVP[0], previousVP[1]), Point2f(vp[0],vp[1])) > pointDistance(Point2f(previousVP[0], previousVP[1]), Point2f(vp[2],vp[3])) &&
+        pointDistance(Point2f(previousVP[2], previousVP[3]), Point2f(vp[2],vp[3])) > pointDistance(Point2f(previousVP[2], previousVP[3]), Point2f(vp[0],vp[1]))){
+
+        vp = Vec4f(vp[2], vp[3], vp[0], vp[1]);
+    }
+
+    previousVP = vp;
+    hasPrevious = true;
+
+    return validVPS(vp);
+}
+
+//mean absolute difference between the current thumbnail and a reference one, FLT_MAX without reference
+float ACCTVPSession::thumbDifference(const Mat &reference){
+    if (thumb.empty() || reference.empty() || reference.size() != thumb.size())
+        return FLT_MAX;
+
+    return (float)(norm(thumb, reference, NORM_L1)/thumb.total());
+}
+
+//eigenvector of the lowest eigenvalue of a normal matrix, the vanishing point of its line segments
+static Vec3f lowestEigenvector(const Mat &ATA){
+    Mat eigenvalues, eigenvectors;
+    eigen(ATA, eigenvalues, eigenvectors);
+
+    return Vec3f(eigenvectors.at<float>(2, 0), eigenvectors.at<float>(2, 1), eigenvectors.at<float>(2, 2));
+}
+
+//standard error in degrees of the direction of a normal matrix of n line segments, as for segments of equal weight:
+//the residual per segment (lowest eigenvalue) over how sharply the fit rises away from the direction (middle eigenvalue)
+static double directionError(const Mat &ATA, int n){
+    Mat eigenvalues;
+    eigen(ATA, eigenvalues);
+
+    double lowest = std::max(0.0f, eigenvalues.at<float>(2)), middle = eigenvalues.at<float>(1);
+    if (n <= 2 || !(middle > 0))
+        return 180;
+
+    return atan(sqrt(lowest/((n - 2)*middle)))*180/CV_PI;
+}
+
+/* ----------------------------------------
+adds the consensus sets of the last detection
+to the still calibration: the normal matrices
+of both vanishing points are summed over the
+frames, so every line segment seen so far
+takes part in one least squares estimate.
+True once the standard error of both pooled
+directions stayed under stillTolerance for
+STILL_STABLE_FRAMES frames in a row.
+-------------------------------------------*/
+bool ACCTVPSession::poolStill(){
+    vector<Mat> ATA;
+    vector<int> sizes;
+    msac.getNormalMatrices(ATA, sizes);
+    if (ATA.size() < 2)
+        return false;
+
+    Vec3f d0 = lowestEigenvector(ATA[0]), d1 = lowestEigenvector(ATA[1]);
+
+    if (stillATA[0].empty()) {
+        stillATA[0] = ATA[0].clone();
+        stillATA[1] = ATA[1].clone();
+        stillLines[0] = sizes[0];
+        stillLines[1] = sizes[1];
+        stillDir[0] = d0;
+        stillDir[1] = d1;
+        return false;
+    }
+
+    //each vanishing point goes to the closer pooled one, detection order may change between frames
+    bool swap = fabs(d0.dot(stillDir[1])) + fabs(d1.dot(stillDir[0])) > fabs(d0.dot(stillDir[0])) + fabs(d1.dot(stillDir[1]));
+    stillATA[0] += ATA[swap ? 1 : 0];
+    stillATA[1] += ATA[swap ? 0 : 1];
+    stillLines[0] += sizes[swap ? 1 : 0];
+    stillLines[1] += sizes[swap ? 0 : 1];
+
+    bool stable = true;
+    for (int k = 0; k < 2; k++) {
+        stillDir[k] = lowestEigenvector(stillATA[k]);
+        stable = stable && directionError(stillATA[k], stillLines[k]) < params.stillTolerance;
+    }
+
+    stillStable = stable ? stillStable + 1 : 0;
+    return params.stillTolerance > 0 && stillStable >= STILL_STABLE_FRAMES;
+}
+
+//pooled still vanishing points in processing pixels, (-1, -1, -1, -1) if there are none or one is at the infinity
+Vec4f ACCTVPSession::pooledStillVPs(){
+    Vec4f result(-1, -1, -1, -1);
+    if (stillATA[0].empty())
+        return result;
+
+    for (int k = 0; k < 2; k++) {
+        Mat d = Mat(stillDir[k]).clone();
+        Mat v = msac.uncalibrate(d);
+        if (v.at<float>(2, 0) != 1)
+            return Vec4f(-1, -1, -1, -1);
+
+        result[2*k] = v.at<float>(0, 0);
+        result[2*k + 1] = v.at<float>(1, 0);
+    }
+
+    return result;
+}
+
+/* ----------------------------------------
+collects the focal length of the first valid
+frames, the median of numFramesCalib of them
+is kept for the rest of the stream and MSAC
+then only looks for an orthogonal second
+vanishing point.
+-------------------------------------------*/
+void ACCTVPSession::lockFocal(float focal){
+    //no focal length fits vanishing points seen at less than 90 degrees
+    if (!(focal > 0) || focal != focal || focal > 1e6)
+        return;
+
+    focalSamples.push_back(focal);
+    if ((int)focalSamples.size() < std::max(1, params.numFramesCalib))
+        return;
+
+    std::nth_element(focalSamples.begin(), focalSamples.begin() + focalSamples.size()/2, focalSamples.end());
+    lockedFocal = focalSamples[focalSamples.size()/2];
+    focalSamples.clear();
+
+    msac.setFocal(lockedFocal*procSize.width/frameSize.width);
+
+    //normal matrices are in calibrated coordinates, the ones pooled with the old focal length don't add up with the next
+    stillATA[0].release();
+    stillATA[1].release();
+    stillStable = 0;
+}
+
+//top-left part of src that fits in dst, the rest of dst is set to value
+static void copyTopLeft(const Mat &src, Mat &dst, double value){
+    int rows = std::min(src.rows, dst.rows);
+    int cols = std::min(src.cols, dst.cols);
+
+    dst.setTo(Scalar::all(value));
+    Mat roi = dst(Rect(0, 0, cols, rows));
+    src(Rect(0, 0, cols, rows)).copyTo(roi);
+}
+
+//copies the top-image into a caller buffer of the same format, rows left by a crop are black
+bool ACCTVPSession::copyTopView(frameBuffer &topView){
+    int format = tv->topImageI420.empty() ? (tv->topImage.channels() == 3 ? FRAME_BGR : FRAME_GRAY) : FRAME_I420;
+    if (topView.format != format) {
+        printf("ERROR: top-view buffer format doesn't match the frame format\n");
+        return false;
+    }
+
+    Mat dst = wrapFrameBuffer(topView);
+
+    if (format != FRAME_I420) {
+        copyTopLeft(tv->topImage, dst, 0);
+        return true;
+    }
+
+    Mat y, u, v, topY, topU, topV;
+    splitI420(dst, y, u, v);
+    splitI420(tv->topImageI420, topY, topU, topV);
+
+    copyTopLeft(topY, y, 0);
+    copyTopLeft(topU, u, 128);
+    copyTopLeft(topV, v, 128);
+
+    return true;
+}
@@ -0,0 +1,151 @@
+//  Plane Projection
+//  ACCTVPSession.h
+//
+//  University of Bristol
+//
+//  Created by Henrique Grandinetti on 13/07/15.
+//  henriquegrandinetti@gmail.com
+
+#ifndef __ACCTVP__ACCTVPSession__
+#define __ACCTVP__ACCTVPSession__
+
+#include <stdio.h>
+
+#include "opencv2/core/core.hpp"
+
+#include "MSAC.h"
+#include "TopView.h"
+#include "vanishingPoint.h"
+
+using namespace cv;
+using namespace std;
+
+#define FRAME_GRAY  0   //8 bit, one channel
+#define FRAME_BGR   1   //8 bit, three interleaved channels
+#define FRAME_I420  2   //8 bit planar YUV 4:2:0, U and V follow Y with half its stride
+
+#define STILL_STABLE_FRAMES 3   //frames the pooled still calibration must stay within stillTolerance
+#define STATIC_THUMB_WIDTH  64  //width of the thumbnails compared to find unchanged frames
+
+typedef struct frameBuffer{
+    uchar *data;
+    size_t stride;  //bytes per (luma) row
+    int width, height;
+    int format;     //FRAME_GRAY, FRAME_BGR or FRAME_I420
+}frameBuffer;
+
+typedef struct sessionParams{
+    detectionParams detection;  //cameraMatrix, scale and tiles are set by the session
+    int procWidth;              //processing width, -1 for the frame width
+    int detectWidth;            //line detection width, -1 for the processing width
+    bool still;                 //camera doesn't move, the line segments of the first frames are pooled and the result kept
+    int numFramesCalib;         //most frames of the still calibration and of the focal length estimation
+    float stillTolerance;       //degrees, the still calibration stops once the standard error of both vanishing point directions is lower, 0 for numFramesCalib frames
+    int numFramesSmooth;        //moving average length of the automatic calibration
+    bool fixedFocal;            //focal length locked after numFramesCalib calibrated frames, then only the rotation is tracked
+    float focal;                //known focal length in frame pixels for fixedFocal, -1 to estimate it
+    Size topSize;               //top-view size, (-1, -1) for the processing size
+    float gsd;                  //ground units per top-view pixel, overrides topSize
+    Rect_<float> crop;          //ground region the top-view is cropped to, in toGroundPlaneCoord units, empty for none
+    Mat distCoeffs;             //lens distortion (k1, k2, p1, p2, k3), empty if none
+    float distFocal;            //focal length in frame pixels the coefficients refer to, -1 for the frame width
+    int overlay;                //OVERLAY_NONE, OVERLAY_VPS, OVERLAY_CLUSTERS or OVERLAY_LINES, drawn only when overlayImage() is asked for
+    bool topImage;              //generates the top-view image of topView() without a caller buffer
+    int groundLUTStep;          //node spacing of the ground lookup table of topView(), 0 for none
+    float staticThreshold;      //mean absolute thumbnail difference (0-255) under which the last vanishing points are kept without detection, 0 for off
+    float staticTopThreshold;   //same, under which the last top-view is kept without warping, 0 for off
+}sessionParams;
+
+typedef struct sessionResult{
+    bool valid;                 //the fields below are set only for valid vanishing points
+    Vec4f vps;                  //two vanishing points in frame pixels
+    float focal;                //focal length in frame pixels
+    Matx33f rotation;           //rows are the ground axes u, v and the normal w in camera coordinates
+    Matx33d homography;         //frame pixels to top-view pixels, undistorted frame pixels if distortion is set
+    Size topSize;
+    bool stillCompleted;        //set on the frame the still calibration was completed
+    int stillFrames;            //frames the still calibration took, set with stillCompleted
+    bool detectionSkipped;      //unchanged frame, the last vanishing points were kept
+    bool topViewReused;         //unchanged frame, the last top-view was kept
+}sessionResult;
+
+sessionParams defaultSessionParams();
+
+/* ----------------------------------------
+calibration and top-view of one video stream.
+Frames are caller-owned buffers read in place,
+all per-stream state (smoothing, still average,
+previous vanishing points) is kept here.
+-------------------------------------------*/
+class ACCTVPSession{
+public:
+    ACCTVPSession(const sessionParams &params, mouseDataCrop *crop = 0);
+
+    bool processFrame(const frameBuffer &frame, sessionResult &result, frameBuffer *topView = 0);
+    void setVanishingPoints(Vec4f vp);
+    void reset();
+
+    Mat frame();
+    Mat overlayImage();
+    const overlayShapes &overlay();
+    const detectionParams &detection();
+    //reads the last frame in place when it needs no resize: warping or cropping it again
+    //is only valid while the caller's buffer still holds that frame, measurements always are
+    Ptr<TopView> topView();
+
+private:
+    sessionParams params;
+    MSAC msac;
+
+    Size frameSize;
+    Size procSize;
+    Size detectSize;
+
+    Mat inputImg, imgGRAY, outputImg;
+    int inputFormat;    //of inputImg
+    bool inPlace;       //inputImg is the caller's frame buffer
+    overlayShapes shapes;
+    bool overlayAxis;   //tv belongs to the last frame
+    Mat lumaImg, chromaU, chromaV;
+
+    vector<Vec4f> vpVector;
+    vector<Vec4f> stillVPS;
+    Vec4f vp, previousVP;
+    bool hasPrevious;
+    Vec4f fixedVPs;     //in frame pixels
+    bool fixedVP;
+    int stillFrames;
+    bool stillCompleted;
+    Mat stillATA[2];    //normal matrices of both vanishing points summed over the still frames
+    Vec3f stillDir[2];  //pooled calibrated directions
+    int stillLines[2];  //line segments pooled in stillATA
+    int stillStable;
+    Mat thumb, detectThumb, topThumb;   //current frame, last detection and last warp
+    Vec4f topVP;        //vanishing points of the top-view in tv
+    bool topGenerated;
+    Rect_<float> topCrop;   //crop of the top-view in tv
+    vector<float> focalSamples;
+    float lockedFocal;  //in frame pixels, 0 until known
+
+    segmentCache segmentTiles;
+    remapCache undistortCache;
+    groundCache groundTable;
+    Mat topBuffer;      //top-image of the last top-view, warped into again by the next one
+    mouseDataCrop ownCrop;
+    mouseDataCrop *crop;
+    Ptr<TopView> tv;
+
+    void configure(const frameBuffer &frame);
+    void ingest(const frameBuffer &frame);
+    bool calibrate(sessionResult &result);
+    void lockFocal(float focal);
+    bool poolStill();
+    Vec4f pooledStillVPs();
+    float thumbDifference(const Mat &reference);
+    bool copyTopView(frameBuffer &topView);
+};
+
+Mat wrapFrameBuffer(const frameBuffer &buffer);
+frameBuffer matFrameBuffer(const Mat &img, Size frameSize);
+
+#endif
@@ -0,0 +1,115 @@
+//  Plane Projection
+//  FrameSource.cpp
+//
+//  University of Bristol
+//
+//  Created by Henrique Grandinetti on 13/07/15.
+//  henriquegrandinetti@gmail.com
+
+#include "FrameSource.h"
+
+FrameSource::FrameSource(){
+    isRaw = false;
+    size = Size(0, 0);
+}
+
+//.y4m files and inputs with a raw size are mapped, anything else goes to VideoCapture
+bool FrameSource::open(const string &input, Size rawSize, bool yuv){
+    release();
+
+    isRaw = input.size() > 4 && input.compare(input.size() - 4, 4, ".y4m") == 0;
+    bool opened;
+
+    if (isRaw)
+        opened = raw.open(input);
+    else if (rawSize.width > 0) {
+        isRaw = true;
+        opened = raw.open(input, rawSize);
+    }
+    else {
+        opened = video.open(input);
+        if (opened && yuv)
+            video.set(CV_CAP_PROP_CONVERT_RGB, 0);
+    }
+
+    if (!opened) {
+        printf("ERROR: can not open %s\n", input.c_str());
+        return false;
+    }
+
+    if (isRaw)
+        size = raw.frameSize();
+    else
+        size = Size((int)video.get(CV_CAP_PROP_FRAME_WIDTH), (int)video.get(CV_CAP_PROP_FRAME_HEIGHT));
+
+    return true;
+}
+
+bool FrameSource::read(Mat &frame){
+    if (isRaw)
+        return raw.read(frame);
+
+    video >> frame;
+    return !frame.empty();
+}
+
+/* ----------------------------------------
+next frame read is "index". Videos are seeked
+by the decoder, which may land on a keyframe
+before it: the position is read back and the
+frames up to index are decoded. Fails when
+the decoder can not tell where it is or went
+past index.
+-------------------------------------------*/
+bool FrameSource::seek(int index){
+    if (isRaw) {
+        if (index < 0 || index > raw.numFrames()) {
+            printf("ERROR: can not seek to frame %d of %d\n", index, raw.numFrames());
+            return false;
+        }
+
+        raw.seek(index);
+        return true;
+    }
+
+    video.set(CV_CAP_PROP_POS_FRAMES, index);
+    int pos = (int)video.get(CV_CAP_PROP_POS_FRAMES);
+
+    if (pos < 0 || pos > index) {
+        printf("ERROR: seeking to frame %d landed on frame %d\n", index, pos);
+        return false;
+    }
+
+    for (; pos < index; pos++) {
+        if (!video.grab()) {
+            printf("ERROR: the input ended at frame %d while seeking to frame %d\n", pos, index);
+            return false;
+        }
+    }
+
+    return true;
+}
+
+void FrameSource::release(){
+    raw.release();
+    video.release();
+}
+
+//frame count from the container for videos, may be approximate
+int FrameSource::numFrames(){
+    if (isRaw)
+        return raw.numFrames();
+
+    return (int)video.get(CV_CAP_PROP_FRAME_COUNT);
+}
+
+Size FrameSource::frameSize(){
+    return size;
+}
+
+double FrameSource::fps(){
+    if (isRaw)
+        return raw.fps();
+
+    return video.get(CV_CAP_PROP_FPS);
+}
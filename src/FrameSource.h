@@ -0,0 +1,47 @@
+//  Plane Projection
+//  FrameSource.h
+//
+//  University of Bristol
+//
+//  Created by Henrique Grandinetti on 13/07/15.
+//  henriquegrandinetti@gmail.com
+
+#ifndef __ACCTVP__FrameSource__
+#define __ACCTVP__FrameSource__
+
+#include <stdio.h>
+
+#include "opencv2/core/core.hpp"
+#include "opencv2/highgui/highgui.hpp"
+
+#include "Y4MReader.h"
+
+using namespace cv;
+using namespace std;
+
+/* ----------------------------------------
+video file, stream or camera read through
+VideoCapture, or a .y4m / raw I420 file read
+in place through Y4MReader.
+-------------------------------------------*/
+class FrameSource{
+public:
+    FrameSource();
+
+    bool open(const string &input, Size rawSize = Size(-1, -1), bool yuv = false);
+    bool read(Mat &frame);
+    bool seek(int index);
+    void release();
+
+    int numFrames();
+    Size frameSize();
+    double fps();
+
+private:
+    VideoCapture video;
+    Y4MReader raw;
+    bool isRaw;
+    Size size;
+};
+
+#endif
@@ -70,6 +70,17 @@ void MSAC::init(cv::Size imSize)
     __K.at<float>(1,1) = (float)__height;
     __K.at<float>(1,2) = (float)__height/2;
     __K.at<float>(2,2) = (float)1;
+    
+    __fixedFocal = false;
+    __orthogonal = false;
+    __joint = false;
+}
+
+void MSAC::setFocal(float focal)
+{
+    __K.at<float>(0,0) = focal;
+    __K.at<float>(1,1) = focal;
+    __fixedFocal = true;
 }
 
 // COMPUTE VANISHING POINTS
@@ -119,8 +130,22 @@ void MSAC::fillDataContainers(std::vector<std::vector<cv::Point> > &lineSegments
     }
     __Lengths = __Lengths*((double)1/sum_lengths);
 }
+void MSAC::setJoint(bool joint)
+{
+    __joint = joint;
+}
+
 void MSAC::multipleVPEstimation(std::vector<std::vector<cv::Point> > &lineSegments, std::vector<std::vector<std::vector<cv::Point> > > &lineSegmentsClusters, std::vector<int> &numInliers, std::vector<cv::Mat> &vps, int numVps)
 {
+    __ATA_vps.clear();
+    __N_vps.clear();
+    
+    if(__joint && numVps == 2)
+    {
+        jointVPEstimation(lineSegments, lineSegmentsClusters, numInliers, vps);
+        return;
+    }
+    
     // Make a copy of lineSegments because it is modified in the code (it will be restored at the end of this function)
     std::vector<std::vector<cv::Point> > lineSegmentsCopy = lineSegments;
     
@@ -141,6 +166,15 @@ void MSAC::multipleVPEstimation(std::vector<std::vector<cv::Point> > &lineSegmen
         // Vector containing indexes for current vp
         std::vector<int> ind_CS;
         
+        // With a known focal length the second vp is orthogonal to the first one: a one-parameter search
+        __orthogonal = __fixedFocal && vpNum == 1 && vps.size() == 1;
+        if(__orthogonal)
+        {
+            __d1 = vps[0].at<float>(2,0) != 0 ? __K.inv()*vps[0] : vps[0].clone();
+            cv::normalize(__d1, __d1);
+        }
+        int mss = __orthogonal ? 1 : __minimal_sample_set_dimension;
+        
         __N_I_best = __minimal_sample_set_dimension;
         __J_best = FLT_MAX;
         
@@ -207,7 +241,7 @@ void MSAC::multipleVPEstimation(std::vector<std::vector<cv::Point> > &lineSegmen
                     else
                     {
                         q = 1;
-                        for (int j=0; j<__minimal_sample_set_dimension; j++)
+                        for (int j=0; j<mss; j++)
                             q *= (double)(__N_I_best - j)/(double)(numLines - j);
                     }
                     // Estimate the number of iterations for RANSAC
@@ -244,7 +278,10 @@ void MSAC::multipleVPEstimation(std::vector<std::vector<cv::Point> > &lineSegmen
         if(__J_best > 0 && ind_CS.size() > (unsigned int)__minimal_sample_set_dimension) // if J==0 maybe its because all line segments are perfectly parallel and the vanishing point is at the infinity
         {
             
-            estimateLS(__Li, __Lengths, ind_CS, __N_I_best, __vp);
+            if(__orthogonal)
+                estimateOrthogonalLS(__Li, __Lengths, ind_CS, __N_I_best, __vp);
+            else
+                estimateLS(__Li, __Lengths, ind_CS, __N_I_best, __vp);
             
             // Uncalibrate
             __vp = __K*__vp;
@@ -262,6 +299,8 @@ void MSAC::multipleVPEstimation(std::vector<std::vector<cv::Point> > &lineSegmen
             
             // Copy to output vector
             vps.push_back(__vp);
+            __ATA_vps.push_back(normalMatrix(__Li, __Lengths, ind_CS, ind_CS.size()));
+            __N_vps.push_back(ind_CS.size());
         }
         else if(fabs(__J_best - 1) < 0.000001)
         {
@@ -281,6 +320,8 @@ void MSAC::multipleVPEstimation(std::vector<std::vector<cv::Point> > &lineSegmen
             }
             // Copy to output vector
             vps.push_back(__vp);
+            __ATA_vps.push_back(normalMatrix(__Li, __Lengths, ind_CS, ind_CS.size()));
+            __N_vps.push_back(ind_CS.size());
         }
         
         // Fill lineSegmentsClusters containing the indexes of inliers for current vps
@@ -303,14 +344,226 @@ void MSAC::multipleVPEstimation(std::vector<std::vector<cv::Point> > &lineSegmen
     // Restore lineSegments
     lineSegments = lineSegmentsCopy;
 }
+cv::Mat MSAC::uncalibrate(cv::Mat &vp)
+{
+    cv::Mat v = __K*vp;
+    if(v.at<float>(2,0) != 0)
+    {
+        v.at<float>(0,0) /= v.at<float>(2,0);
+        v.at<float>(1,0) /= v.at<float>(2,0);
+        v.at<float>(2,0) = 1;
+        return v;
+    }
+    
+    // Since this is infinite, it is better to leave it calibrated
+    return vp.clone();
+}
+
+bool MSAC::orthogonalPair(cv::Mat &d1, cv::Mat &d2)
+{
+    // In image coordinates, (v1 - c)·(v2 - c) = -f^2 for orthogonal directions
+    cv::Mat p = __K*d1;
+    cv::Mat q = __K*d2;
+    float cx = __K.at<float>(0,2), cy = __K.at<float>(1,2);
+    
+    double pz = p.at<float>(2,0), qz = q.at<float>(2,0);
+    if(pz == 0 || qz == 0)
+        return false;
+    
+    double g = (p.at<float>(0,0) - cx*pz)*(q.at<float>(0,0) - cx*qz) + (p.at<float>(1,0) - cy*pz)*(q.at<float>(1,0) - cy*qz);
+    
+    return g*pz*qz < 0;
+}
+
+/* Both vanishing points from one RANSAC: a hypothesis is a first vp from two segments and a second
+   one orthogonal to it, from a single segment when the focal length is known or from two segments
+   whose pair admits a real focal length otherwise. Every segment goes to the closer vp and the two
+   consensus sets are scored together, so no second RANSAC runs on the remaining segments. */
+void MSAC::jointVPEstimation(std::vector<std::vector<cv::Point> > &lineSegments, std::vector<std::vector<std::vector<cv::Point> > > &lineSegmentsClusters, std::vector<int> &numInliers, std::vector<cv::Mat> &vps)
+{
+    fillDataContainers(lineSegments);
+    int numLines = lineSegments.size();
+    
+    if(numLines < 4)
+        return;
+    
+    int mss2 = __fixedFocal ? 1 : 2;
+    
+    std::vector<int> labels(numLines, -1), labelsBest(numLines, -1);
+    std::vector<int> set(2, 0);
+    cv::Mat d1, d2, d1Best, d2Best;
+    float J_best = FLT_MAX;
+    int N_best = 0;
+    
+    int iter = 0;
+    int T_iter = INT_MAX;
+    while(iter <= __min_iters || iter <= T_iter)
+    {
+        iter++;
+        if(iter > MSAC_JOINT_MAX_ITERS)
+            break;
+        
+        // Hypothesize ------------------------
+        set[0] = __rng.uniform(0, numLines);
+        set[1] = __rng.uniform(0, numLines);
+        estimateLS(__Li, __Lengths, set, 2, d1);
+        
+        if(__fixedFocal)
+        {
+            cv::Mat ls = __Li.row(__rng.uniform(0, numLines)).t();
+            d2 = ls.cross(d1);
+            cv::normalize(d2, d2);
+        }
+        else
+        {
+            set[0] = __rng.uniform(0, numLines);
+            set[1] = __rng.uniform(0, numLines);
+            estimateLS(__Li, __Lengths, set, 2, d2);
+            
+            if(!orthogonalPair(d1, d2))
+                continue;
+        }
+        
+        // Repeated or parallel samples give no vp
+        if(cv::norm(d1) < 0.5 || cv::norm(d2) < 0.5)
+            continue;
+        
+        // Test --------------------------------
+        // Both consensus sets in one pass, lines in __Li and vps are unit vectors
+        const float *a = d1.ptr<float>(0);
+        const float *b = d2.ptr<float>(0);
+        int N1 = 0, N2 = 0;
+        float J = 0;
+        for(int i=0; i<numLines; i++)
+        {
+            const float *l = __Li.ptr<float>(i);
+            float e1 = a[0]*l[0] + a[1]*l[1] + a[2]*l[2];
+            float e2 = b[0]*l[0] + b[1]*l[1] + b[2]*l[2];
+            e1 *= e1;
+            e2 *= e2;
+            
+            if(e1 <= e2 && e1 <= __T_noise_squared)
+            {
+                labels[i] = 0;
+                N1++;
+                J += e1;
+            }
+            else if(e2 < e1 && e2 <= __T_noise_squared)
+            {
+                labels[i] = 1;
+                N2++;
+                J += e2;
+            }
+            else
+            {
+                labels[i] = -1;
+                J += __T_noise_squared;
+            }
+        }
+        
+        if(N1 < 2 || N2 < mss2)
+            continue;
+        
+        J /= (N1 + N2);
+        
+        // Update ------------------------------
+        if(J < J_best)
+        {
+            J_best = J;
+            labelsBest = labels;
+            d1Best = d1.clone();
+            d2Best = d2.clone();
+            
+            if(N1 + N2 > N_best)
+            {
+                // Two segments of the first set and mss2 of the second one
+                double q = pow((double)N1/numLines, 2) * pow((double)N2/numLines, mss2);
+                if((1-q) > 1e-12)
+                    T_iter = (int)ceil( log((double)__epsilon) / log((double)(1-q)));
+                else
+                    T_iter = 0;
+            }
+            N_best = N1 + N2;
+        }
+    }
+    
+    if(J_best == FLT_MAX)
+        return;
+    
+    // Reestimate ------------------------------
+    std::vector<int> ind_CS1, ind_CS2;
+    std::vector<std::vector<cv::Point> > lineSegments1, lineSegments2;
+    for(int i=0; i<numLines; i++)
+    {
+        if(labelsBest[i] == 0)
+        {
+            ind_CS1.push_back(i);
+            lineSegments1.push_back(lineSegments[i]);
+        }
+        else if(labelsBest[i] == 1)
+        {
+            ind_CS2.push_back(i);
+            lineSegments2.push_back(lineSegments[i]);
+        }
+    }
+    
+    cv::Mat v1 = d1Best.clone(), v2 = d2Best.clone();
+    if(ind_CS1.size() > 2)
+        estimateLS(__Li, __Lengths, ind_CS1, ind_CS1.size(), v1);
+    if(ind_CS2.size() > 2)
+    {
+        if(__fixedFocal)
+        {
+            __d1 = v1;
+            estimateOrthogonalLS(__Li, __Lengths, ind_CS2, ind_CS2.size(), v2);
+        }
+        else
+            estimateLS(__Li, __Lengths, ind_CS2, ind_CS2.size(), v2);
+    }
+    
+    // The refined pair must still be orthogonal for some focal length
+    if(!__fixedFocal && !orthogonalPair(v1, v2))
+    {
+        v1 = d1Best;
+        v2 = d2Best;
+    }
+    
+    vps.push_back(uncalibrate(v1));
+    vps.push_back(uncalibrate(v2));
+    
+    __ATA_vps.push_back(normalMatrix(__Li, __Lengths, ind_CS1, ind_CS1.size()));
+    __ATA_vps.push_back(normalMatrix(__Li, __Lengths, ind_CS2, ind_CS2.size()));
+    __N_vps.push_back(ind_CS1.size());
+    __N_vps.push_back(ind_CS2.size());
+    
+    lineSegmentsClusters.push_back(lineSegments1);
+    lineSegmentsClusters.push_back(lineSegments2);
+    
+    numInliers.push_back(ind_CS1.size());
+    numInliers.push_back(ind_CS2.size());
+}
+
 // RANSAC
 void MSAC::GetMinimalSampleSet(cv::Mat &Li, cv::Mat &Lengths, cv::Mat &Mi, std::vector<int> &MSS, cv::Mat &vp)
 {
     int N = Li.rows;
     
+    // A single sample fixes a vp orthogonal to the first one: where its line crosses the orthogonal great circle
+    if(__orthogonal)
+    {
+        MSS[0] = __rng.uniform(0, N);
+        
+        cv::Mat ls0 = Li.row(MSS[0]).t();
+        vp = ls0.cross(__d1);
+        cv::normalize(vp, vp);
+        
+        return;
+    }
+    
     // Generate a pair of samples
-    while (N <= (MSS[0] = rand() / (RAND_MAX/(N-1))));
-    while (N <= (MSS[1] = rand() / (RAND_MAX/(N-1))));
+    // per-object generator, so several MSAC objects can run in parallel
+    MSS[0] = __rng.uniform(0, N);
+    MSS[1] = __rng.uniform(0, N);
     
     // Estimate the vanishing point and the residual error
     
@@ -405,6 +658,56 @@ void MSAC::estimateLS(cv::Mat &Li, cv::Mat &Lengths, std::vector<int> &set, int
     return;
 }
 
+cv::Mat MSAC::normalMatrix(cv::Mat &Li, cv::Mat &Lengths, std::vector<int> &set, int set_length)
+{
+    // Sum of w^2 li li^T, the same matrix as L.t()*Tau.t()*Tau*L in estimateLS
+    cv::Mat ATA = Mat::zeros(3,3,CV_32F);
+    for(int i=0; i<set_length; i++)
+    {
+        cv::Mat li = Li.row(set[i]).t();
+        float w = Lengths.at<float>(set[i],set[i]);
+        ATA += (w*w)*li*li.t();
+    }
+    
+    return ATA;
+}
+
+void MSAC::getNormalMatrices(std::vector<cv::Mat> &ATA, std::vector<int> &sizes)
+{
+    ATA = __ATA_vps;
+    sizes = __N_vps;
+}
+
+void MSAC::estimateOrthogonalLS(cv::Mat &Li, cv::Mat &Lengths, std::vector<int> &set, int set_length, cv::Mat &vp)
+{
+    // Orthonormal basis (e1, e2) of the directions orthogonal to __d1
+    cv::Mat axis = Mat::zeros(3,1,CV_32F);
+    int k = 0;
+    for(int i=1; i<3; i++)
+        if(fabs(__d1.at<float>(i,0)) < fabs(__d1.at<float>(k,0)))
+            k = i;
+    axis.at<float>(k,0) = 1;
+    
+    cv::Mat e1 = __d1.cross(axis);
+    cv::normalize(e1, e1);
+    cv::Mat e2 = __d1.cross(e1);
+    
+    cv::Mat ATA = normalMatrix(Li, Lengths, set, set_length);
+    
+    // Least squares within the plane (e1, e2): the 2x2 eigenvector with lowest eigenvalue
+    cv::Mat B = Mat(3,2,CV_32F);
+    cv::Mat b0 = B.col(0), b1 = B.col(1);
+    e1.copyTo(b0);
+    e2.copyTo(b1);
+    cv::Mat C = B.t()*ATA*B;
+    
+    cv::Mat eigenvalues, eigenvectors;
+    cv::eigen(C, eigenvalues, eigenvectors);
+    
+    vp = B*eigenvectors.row(1).t();
+    cv::normalize(vp, vp);
+}
+
 // Error functions
 float MSAC::errorLS(int vpNum, cv::Mat &Li, cv::Mat &vp, std::vector<float> &E, int *CS_counter)
 {
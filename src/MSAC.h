@@ -24,6 +24,8 @@
 #define MODE_LS		0
 #define MODE_NIETO	1
 
+#define MSAC_JOINT_MAX_ITERS	2000	// hypotheses of the joint estimation of two vps
+
 class MSAC
 {
 public:
@@ -57,6 +59,15 @@ private:
     
     // Calibration
     cv::Mat __K;				// Approximated Camera calibration matrix
+    bool __fixedFocal;			// __K holds a known focal length
+    bool __orthogonal;			// current vp is searched orthogonal to the first one
+    cv::Mat __d1;				// calibrated direction of the first vp
+    bool __joint;				// two vps are estimated together as an orthogonal pair
+    std::vector<cv::Mat> __ATA_vps;		// normal matrices of the consensus sets of the last vps
+    std::vector<int> __N_vps;			// sizes of those consensus sets
+    
+    // Random sampling
+    cv::RNG __rng;
     
     // Data (Line Segments)
     cv::Mat __Li;				// Matrix of appended line segments (3xN) for N line segments
@@ -73,6 +84,19 @@ public:
     /** Initialisation of MSAC procedure*/
     void init(cv::Size imSize);
     
+    /** Known focal length in pixels, the second vanishing point is then searched only along the directions orthogonal to the first one*/
+    void setFocal(float focal);
+    
+    /** Two vanishing points are estimated together, as a pair of orthogonal directions scored in a single RANSAC, instead of one after the other*/
+    void setJoint(bool joint);
+    
+    /** Weighted normal matrices (ATA) of the consensus sets of the vanishing points of the last estimation, in calibrated coordinates and in the order of the vps, with the number of line segments of each.
+     Summed over several images, the eigenvector with lowest eigenvalue of the sum is the vanishing point of all their line segments*/
+    void getNormalMatrices(std::vector<cv::Mat> &ATA, std::vector<int> &sizes);
+    
+    /** Calibrated vanishing point to image coordinates, points at the infinity are left calibrated*/
+    cv::Mat uncalibrate(cv::Mat &vp);
+    
     /** Main function which returns, if detected, several vanishing points and a vector of containers of line segments
      corresponding to each Consensus Set.*/
     void multipleVPEstimation(std::vector<std::vector<cv::Point> > &lineSegments, std::vector<std::vector<std::vector<cv::Point> > > &lineSegmentsClusters, std::vector<int> &numInliers, std::vector<cv::Mat> &vps, int numVps);
@@ -81,6 +105,12 @@ public:
     void drawCS(cv::Mat &im, std::vector<std::vector<std::vector<cv::Point> > > &lineSegmentsClusters, std::vector<cv::Mat> &vps);
     
 private:
+    /** Joint estimation of two orthogonal vanishing points*/
+    void jointVPEstimation(std::vector<std::vector<cv::Point> > &lineSegments, std::vector<std::vector<std::vector<cv::Point> > > &lineSegmentsClusters, std::vector<int> &numInliers, std::vector<cv::Mat> &vps);
+    
+    /** True if two calibrated vanishing points can be orthogonal directions for some real focal length*/
+    bool orthogonalPair(cv::Mat &d1, cv::Mat &d2);
+    
     /** This function returns a randomly selected MSS*/
     void GetMinimalSampleSet(cv::Mat &Li, cv::Mat &Lengths, cv::Mat &Mi, std::vector<int> &MSS, cv::Mat &vp);
     
@@ -94,6 +124,12 @@ private:
     /** This function estimates the vanishing point for a given set of line segments using the Least-squares procedure*/
     void estimateLS(cv::Mat &Li, cv::Mat &Lengths, std::vector<int> &set, int set_length, cv::Mat &vEst);
     
+    /** Weighted normal matrix of the line segments of a set, as built by estimateLS*/
+    cv::Mat normalMatrix(cv::Mat &Li, cv::Mat &Lengths, std::vector<int> &set, int set_length);
+    
+    /** Same as estimateLS with the vanishing point constrained to the directions orthogonal to __d1*/
+    void estimateOrthogonalLS(cv::Mat &Li, cv::Mat &Lengths, std::vector<int> &set, int set_length, cv::Mat &vEst);
+    
     // Error functions
     /** This function computes the residuals of the line segments given a vanishing point using the Least-squares method*/
     float errorLS(int vpNum, cv::Mat &Li, cv::Mat &vp, std::vector<float> &E, int *CS_counter);
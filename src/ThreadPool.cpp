@@ -0,0 +1,242 @@
+//  Plane Projection
+//  ThreadPool.cpp
+//
+//  University of Bristol
+//
+//  Created by Henrique Grandinetti on 13/07/15.
+//  henriquegrandinetti@gmail.com
+
+#include "ThreadPool.h"
+
+#define POOL_CHUNKS_PER_THREAD  4   //loop chunks per worker, enough to even out uneven chunks
+
+//pool and queue of the calling thread, none outside pool workers
+static thread_local ThreadPool *currentPool = 0;
+static thread_local int currentIndex = -1;
+
+//one range of a parallelFor loop
+class loopChunk : public poolTask{
+public:
+    loopChunk(const ParallelLoopBody *body, Range range, std::atomic<int> *remaining, ThreadPool *pool) : body(body), range(range), remaining(remaining), pool(pool){}
+
+    //the chunks may be gone once the last one is counted, nothing of this is read after
+    virtual void run(){
+        (*body)(range);
+
+        ThreadPool *owner = pool;
+        if (--(*remaining) == 0)
+            owner->wakeAll();
+    }
+
+private:
+    const ParallelLoopBody *body;
+    Range range;
+    std::atomic<int> *remaining;
+    ThreadPool *pool;
+};
+
+ThreadPool::ThreadPool(int numThreads){
+    if (numThreads <= 0)
+        numThreads = std::max(1, (int)std::thread::hardware_concurrency());
+
+    queued = 0;
+    sharedQueued = 0;
+    pending = 0;
+    stop = false;
+
+    for (int i = 0; i < numThreads; i++)
+        queues.push_back(new workerQueue());
+
+    for (int i = 0; i < numThreads; i++)
+        threads.push_back(std::thread(&ThreadPool::workerLoop, this, i));
+}
+
+//queued tasks that did not start are dropped, call wait() first to finish them
+ThreadPool::~ThreadPool(){
+    {
+        std::lock_guard<std::mutex> lk(sleepLock);
+        stop = true;
+    }
+    wake.notify_all();
+
+    for (size_t i = 0; i < threads.size(); i++)
+        threads[i].join();
+
+    for (size_t i = 0; i < queues.size(); i++)
+        delete queues[i];
+}
+
+int ThreadPool::numThreads(){
+    return (int)threads.size();
+}
+
+ThreadPool *ThreadPool::current(){
+    return currentPool;
+}
+
+//queues a task behind every task already submitted, the task may submit itself again
+void ThreadPool::submit(poolTask *task){
+    push(-1, task);
+}
+
+//blocks until every submitted task has finished, not to be called from a task
+void ThreadPool::wait(){
+    std::unique_lock<std::mutex> lk(sleepLock);
+    while (pending > 0)
+        done.wait(lk);
+}
+
+/* ----------------------------------------
+runs body over range split in chunks. The
+calling thread keeps running chunks, its own
+or stolen, until all of them are done, so
+nested loops never block a worker.
+-------------------------------------------*/
+void ThreadPool::parallelFor(const Range &range, const ParallelLoopBody &body){
+    int n = range.end - range.start;
+    int numChunks = std::min(n, numThreads()*POOL_CHUNKS_PER_THREAD);
+
+    if (numChunks <= 1) {
+        if (n > 0)
+            body(range);
+        return;
+    }
+
+    int self = currentPool == this ? currentIndex : -1;
+    std::atomic<int> remaining(numChunks);
+
+    vector<loopChunk> chunks;
+    chunks.reserve(numChunks);
+    for (int i = 0; i < numChunks; i++) {
+        Range r(range.start + (int)((int64)n*i/numChunks), range.start + (int)((int64)n*(i + 1)/numChunks));
+        chunks.push_back(loopChunk(&body, r, &remaining, this));
+    }
+
+    //the first chunk is run here, the rest can be stolen
+    for (int i = numChunks - 1; i > 0; i--)
+        push(self, &chunks[i]);
+
+    chunks[0].run();
+
+    //sleeps while the missing chunks run elsewhere, woken by new tasks or the last chunk
+    while (remaining > 0) {
+        poolTask *task = findTask(self, self < 0);
+        if (task) {
+            execute(task);
+            continue;
+        }
+
+        //a worker does not take tasks of the shared queue here, they do not count
+        std::unique_lock<std::mutex> lk(sleepLock);
+        while (remaining > 0 && queued - (self < 0 ? 0 : (int)sharedQueued) <= 0)
+            wake.wait(lk);
+    }
+}
+
+//counted before it is published, a worker may run it and finish it before this returns
+void ThreadPool::push(int index, poolTask *task){
+    pending++;
+    queued++;
+
+    if (index < 0) {
+        sharedQueued++;
+        std::lock_guard<std::mutex> lk(sharedLock);
+        shared.push_back(task);
+    }
+    else {
+        std::lock_guard<std::mutex> lk(queues[index]->lock);
+        queues[index]->tasks.push_back(task);
+    }
+
+    //every sleeper, a thread waiting in parallelFor may not be able to take this task
+    wakeAll();
+}
+
+//wakes every thread waiting for tasks or a finished loop
+void ThreadPool::wakeAll(){
+    //taking the lock orders what changed before a thread going to sleep
+    {
+        std::lock_guard<std::mutex> lk(sleepLock);
+    }
+    wake.notify_all();
+}
+
+void ThreadPool::execute(poolTask *task){
+    task->run();
+
+    if (--pending == 0) {
+        std::lock_guard<std::mutex> lk(sleepLock);
+        done.notify_all();
+    }
+}
+
+//own deque newest first, then the shared queue oldest first, then the oldest task of another worker
+poolTask *ThreadPool::findTask(int index, bool useShared){
+    poolTask *task = 0;
+
+    if (index >= 0) {
+        std::lock_guard<std::mutex> lk(queues[index]->lock);
+        if (!queues[index]->tasks.empty()) {
+            task = queues[index]->tasks.back();
+            queues[index]->tasks.pop_back();
+        }
+    }
+
+    if (!task && useShared) {
+        std::lock_guard<std::mutex> lk(sharedLock);
+        if (!shared.empty()) {
+            task = shared.front();
+            shared.pop_front();
+            sharedQueued--;
+        }
+    }
+
+    int n = (int)queues.size();
+    for (int k = 1; !task && k <= n; k++) {
+        int victim = (std::max(index, 0) + k) % n;
+        if (victim == index)
+            continue;
+
+        std::lock_guard<std::mutex> lk(queues[victim]->lock);
+        if (!queues[victim]->tasks.empty()) {
+            task = queues[victim]->tasks.front();
+            queues[victim]->tasks.pop_front();
+        }
+    }
+
+    if (task)
+        queued--;
+
+    return task;
+}
+
+void ThreadPool::workerLoop(int index){
+    currentPool = this;
+    currentIndex = index;
+
+    for (;;) {
+        poolTask *task = findTask(index, true);
+
+        if (task) {
+            execute(task);
+            continue;
+        }
+
+        std::unique_lock<std::mutex> lk(sleepLock);
+        while (!stop && queued == 0)
+            wake.wait(lk);
+
+        if (stop)
+            return;
+    }
+}
+
+//runs on the pool of the calling worker, OpenCV's own threads otherwise
+void parallelFor(const Range &range, const ParallelLoopBody &body){
+    ThreadPool *pool = ThreadPool::current();
+
+    if (pool)
+        pool->parallelFor(range, body);
+    else
+        parallel_for_(range, body);
+}
@@ -0,0 +1,81 @@
+//  Plane Projection
+//  ThreadPool.h
+//
+//  University of Bristol
+//
+//  Created by Henrique Grandinetti on 13/07/15.
+//  henriquegrandinetti@gmail.com
+
+#ifndef __ACCTVP__ThreadPool__
+#define __ACCTVP__ThreadPool__
+
+#include <stdio.h>
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+
+#include "opencv2/core/core.hpp"
+
+using namespace cv;
+using namespace std;
+
+class poolTask{
+public:
+    virtual ~poolTask(){}
+    virtual void run() = 0;
+};
+
+/* ----------------------------------------
+work-stealing pool shared by all streams.
+Tasks submitted with submit() go through one
+FIFO queue, so streams take turns. Loop chunks
+of parallelFor() go to the deque of the calling
+worker and are stolen by idle workers, the
+caller runs chunks while it waits.
+-------------------------------------------*/
+class ThreadPool{
+public:
+    ThreadPool(int numThreads = 0);
+    ~ThreadPool();
+
+    void submit(poolTask *task);
+    void parallelFor(const Range &range, const ParallelLoopBody &body);
+    void wait();
+    int numThreads();
+
+    static ThreadPool *current();
+
+private:
+    friend class loopChunk;
+
+    typedef struct workerQueue{
+        deque<poolTask *> tasks;
+        std::mutex lock;
+    }workerQueue;
+
+    vector<workerQueue *> queues;
+    vector<std::thread> threads;
+
+    deque<poolTask *> shared;
+    std::mutex sharedLock;
+
+    std::mutex sleepLock;
+    std::condition_variable wake, done;
+    std::atomic<int> queued;    //tasks waiting in any queue
+    std::atomic<int> sharedQueued;  //of queued, in the shared queue
+    std::atomic<int> pending;   //submitted tasks not finished yet
+    bool stop;
+
+    void workerLoop(int index);
+    void push(int index, poolTask *task);
+    void wakeAll();
+    void execute(poolTask *task);
+    poolTask *findTask(int index, bool useShared);
+};
+
+void parallelFor(const Range &range, const ParallelLoopBody &body);
+
+#endif
@@ -8,11 +8,15 @@
 
 #include "TopView.h"
 #include "geometry.h"
+#include "warp.h"
 
 #include <iostream>
 
+#define TOPVIEW_MAX_SIZE    8192    //largest top-image side when sized by ground sampling
+#define TOPVIEW_MAX_LEVEL   4       //coarsest pyramid level used for far-field minification
+
 TopView::TopView(Mat img, Point2f vp1, Point2f vp2, mouseDataCrop *mouse){
-    image = Mat(img).clone();
+    image = img;
     ref = Point2f(image.cols/2, image.rows/2);
     mouseData = mouse;
     transformationMat = Mat(3,3, CV_8UC1);
@@ -42,6 +46,14 @@ TopView::TopView(Mat img, Point2f vp1, Point2f vp2, mouseDataCrop *mouse){
     sf = 1.0;
     O = Point3f(0.0,0.0,0.0);
     
+    outputSize = Size(image.cols, image.rows);
+    gsd = 0;
+    distFocal = image.cols;
+    distCache = 0;
+    lutStep = 0;
+    lutCache = 0;
+    lutDirty = true;
+    
     //must follow this order
     ComputeUVW();
     ComputeM();
@@ -86,7 +98,8 @@ void TopView::ComputeM(){
     Mi = M.inv();
 }
 
-void TopView::drawAxis(Mat output, Point p){
+//world axis at image point p, on an output "scale" times the image size
+void TopView::drawAxis(Mat output, Point p, float scale){
     
     Point3f Pw = convertToWorldCoord(Point3f(p.x, p.y, f));
     
@@ -98,9 +111,10 @@ void TopView::drawAxis(Mat output, Point p){
     vAxis = convertToCamCoord(vAxis);
     wAxis = convertToCamCoord(wAxis);
             
-    line(output, p + ref, IPProjection(uAxis), Scalar(0,0,255));
-    line(output, p + ref, IPProjection(vAxis), Scalar(0,255,0));
-    line(output, p + ref, IPProjection(wAxis), Scalar(255,0,0));
+    Point2f origin = Point2f(p + ref)*scale;
+    line(output, origin, Point2f(IPProjection(uAxis))*scale, Scalar(0,0,255));
+    line(output, origin, Point2f(IPProjection(vAxis))*scale, Scalar(0,255,0));
+    line(output, origin, Point2f(IPProjection(wAxis))*scale, Scalar(255,0,0));
 }
 
 Point3f TopView::convertToCamCoord(Point3f A){
@@ -129,7 +143,12 @@ Point TopView::IPProjection(Point3f P){
     return Point(P2.x, P2.y) + ref;
 }
 
-void TopView::generateTopImage(){
+/* ----------------------------------------
+finds the homography from the image to the
+top-image, its size and the spans of the
+ground footprint, without warping anything.
+-------------------------------------------*/
+void TopView::computeTransformation(){
     
     //assume center of image is on the ground plane
     Point3f P = convertToWorldCoord(Point3f(0, 0, f));
@@ -188,44 +207,359 @@ void TopView::generateTopImage(){
     }
     
     
-    //fit points into image rectangle
-    topImage = Mat(image.rows, image.cols, image.type());
+    //size the top-image from the ground sampling distance
+    Size size = outputSize;
+    if (gsd > 0) {
+        Point2f min = dest_points[0], max = dest_points[0];
+        for (int i = 1; i < 4; i++) {
+            min.x = std::min(min.x, dest_points[i].x); min.y = std::min(min.y, dest_points[i].y);
+            max.x = std::max(max.x, dest_points[i].x); max.y = std::max(max.y, dest_points[i].y);
+        }
+        
+        float width = (max.x - min.x)/(sf * gsd);
+        float height = (max.y - min.y)/(sf * gsd);
+        float limit = std::max(1.0f, std::max(width, height)/TOPVIEW_MAX_SIZE);
+        
+        size = Size(std::max(1, cvCeil(width/limit)), std::max(1, cvCeil(height/limit)));
+    }
+    
+    //planar YUV 4:2:0 needs even sizes
+    if (!chromaU.empty()) {
+        size.width = std::max(2, size.width & ~1);
+        size.height = std::max(2, size.height & ~1);
+    }
     
-    fitQuadRec(dest_points, dest_points, Size(topImage.cols, topImage.rows));
+    //fit points into image rectangle
+    fitQuadRec(dest_points, dest_points, size);
+    
+    //ground footprint in the source image: the image on the side of the horizon of its centre, 20 pixels away from it.
+    //It has five corners when the horizon crosses two adjacent borders, more than the quad above
+    vector<Point2f> footprint;
+    footprint.push_back(Point2f(0, 0));
+    footprint.push_back(Point2f(image.cols, 0));
+    footprint.push_back(Point2f(image.cols, image.rows));
+    footprint.push_back(Point2f(0, image.rows));
+    
+    Point2f normal(Fu.y - Fv.y, Fv.x - Fu.x);
+    float length = sqrt(normal.dot(normal));
+    if (length > 0) {
+        normal *= 1/length;
+        float c = normal.dot(Point2f(Fu.x, Fu.y) + Point2f(ref));
+        if (normal.dot(Point2f(ref)) < c) {
+            normal *= -1;
+            c = -c;
+        }
+        footprint = clipPolygon(footprint, normal, c + 20);
+    }
     
     Mat transform_matrix(3,3, CV_8UC1);
     
     transform_matrix = getPerspectiveTransform(source_points, dest_points);
     
-    float height = topImage.rows;
-    //if image is croped
-    if (mouseData->rec.size() > 1) {
-        mouseData->rec.push_back(Point2f(mouseData->rec[1].x, mouseData->rec[0].y));
-        mouseData->rec.push_back(Point2f(mouseData->rec[0].x, mouseData->rec[1].y));
+    float height = size.height;
+    //cropped ground region, one homography from the image straight to it
+    if (mouseData->ground.area() > 0) {
+        Rect_<float> crop = mouseData->ground;
+        
+        //top-image pixels per ground unit, the region fits in the output size
+        float s;
+        if (gsd > 0)
+            s = std::min(1/gsd, TOPVIEW_MAX_SIZE/std::max(crop.width, crop.height));
+        else
+            s = std::min(outputSize.width/crop.width, outputSize.height/crop.height);
+        
+        size = Size(std::max(1, cvRound(crop.width*s)), std::max(1, cvRound(crop.height*s)));
+        if (!chromaU.empty()) {
+            size.width = std::max(2, size.width & ~1);
+            size.height = std::max(2, size.height & ~1);
+        }
+        height = size.height;
+        
+        Mat toCrop(Matx33d(s, 0, -crop.x*s, 0, s, -crop.y*s, 0, 0, 1));
+        transform_matrix = toCrop * groundHomography();
+    }
+    
+    transformationMat = transform_matrix.clone();
+    lutDirty = true;
+    
+    //only the projected footprint is warped, everything else stays black
+    perspectiveTransform(footprint, footprint, transform_matrix);
+    topSize = Size(size.width, (int)height);
+    polygonSpans(footprint, topSize, spans);
+}
+
+void TopView::generateTopImage(){
+    computeTransformation();
+    
+    //warped into the buffer of the last top-image when it has the size, only what is off the ground is cleared
+    if (chromaU.empty()) {
+        topImage = topBuffer;
+        topImage.create(topSize, image.type());
+        if (distCoeffs.empty())
+            clearOutsideSpans(topImage, spans, 0);
+        warpTopImage(transformationMat);
+        return;
+    }
+    
+    //Y, U and V planes of a single I420 image, black is Y 0 and UV 128
+    int rows = std::max(2, topSize.height & ~1);
+    topImageI420 = topBuffer;
+    topImageI420.create(rows*3/2, topSize.width, CV_8UC1);
+    topImage = topImageI420.rowRange(0, rows);
+    
+    spans.resize(rows);
+    if (distCoeffs.empty())
+        clearOutsideSpans(topImage, spans, 0);
+    warpTopImage(transformationMat);
+    warpChroma(transformationMat);
+}
+
+/* ----------------------------------------
+storage generateTopImage warps into when its
+size and type match, e.g. the top-image of the
+previous frame. Nothing else may read it from
+then on.
+-------------------------------------------*/
+void TopView::setTopBuffer(Mat buffer){
+    topBuffer = buffer;
+}
+
+//homography from the input image to the top-image
+Mat TopView::getTransformation(){
+    return transformationMat;
+}
+
+//size of the top-image, known once the transformation is computed
+Size TopView::getTopSize(){
+    return topSize;
+}
+
+//focal length in pixels implied by the two vanishing points
+float TopView::getFocal(){
+    return f;
+}
+
+//known focal length in pixels instead of the one implied by the vanishing points, only the rotation is recomputed
+void TopView::setFocal(float focal){
+    f = focal;
+    Fu.z = f;
+    Fv.z = f;
+    
+    ComputeUVW();
+    ComputeM();
+    lutDirty = true;
+}
+
+//camera rotation, its rows are the ground axes u, v and the normal w in camera coordinates
+Matx33f TopView::getRotation(){
+    return Matx33f(M.ptr<float>());
+}
+
+/* ----------------------------------------
+warps the subsampled chroma planes into the
+I420 top-image with the luma homography taken
+to chroma coordinates.
+-------------------------------------------*/
+void TopView::warpChroma(Mat &transform_matrix){
+    int rows = topImage.rows/2, cols = topImage.cols/2;
+    uchar *planes = topImageI420.ptr<uchar>(topImage.rows);
+    Mat topU(rows, cols, CV_8UC1, planes);
+    Mat topV(rows, cols, CV_8UC1, planes + rows*cols);
+    
+    //chroma samples sit in the middle of 2x2 luma samples
+    Mat up(Matx33d(2, 0, 0.5, 0, 2, 0.5, 0, 0, 1));
+    Mat down(Matx33d(0.5, 0, -0.25, 0, 0.5, -0.25, 0, 0, 1));
+    Mat H = down * transform_matrix * up;
+    
+    //luma spans without their border margin, chroma outside the source would not be neutral
+    vector<Vec2i> chromaSpans(rows, Vec2i(0, 0));
+    for (int y = 0; y < rows; y++) {
+        Vec2i a = spans[2*y], b = spans[2*y + 1];
+        if (a[1] <= a[0] || b[1] <= b[0])
+            continue;
         
-        height = (float)(mouseData->rec[1].y - mouseData->rec[0].y)/(mouseData->rec[1].x - mouseData->rec[0].x) * topImage.cols;
+        int start = (std::max(a[0], b[0]) + 2)/2;
+        int end = std::min(cols, (std::min(a[1], b[1]) - 1)/2);
+        if (start < end)
+            chromaSpans[y] = Vec2i(start, end);
+    }
+    
+    clearOutsideSpans(topU, chromaSpans, 128);
+    clearOutsideSpans(topV, chromaSpans, 128);
+    warpPerspectiveFast(chromaU, topU, H, topU.size(), &chromaSpans);
+    warpPerspectiveFast(chromaV, topV, H, topV.size(), &chromaSpans);
+}
+
+//source pixels covered by one top-view pixel at (x, y), m maps the top-view to the source
+static float minification(const double *m, double x, double y){
+    double W = m[6]*x + m[7]*y + m[8];
+    if (W == 0)
+        return 1;
+    
+    double u = (m[0]*x + m[1]*y + m[2])/W;
+    double v = (m[3]*x + m[4]*y + m[5])/W;
+    
+    double dux = (m[0] - u*m[6])/W, dvx = (m[3] - v*m[6])/W;
+    double duy = (m[1] - u*m[7])/W, dvy = (m[4] - v*m[7])/W;
+    
+    return (float)std::max(sqrt(dux*dux + dvx*dvx), sqrt(duy*duy + dvy*dvy));
+}
+
+/* ----------------------------------------
+warps the footprint spans into topImage.
+Rows where one top-view pixel covers several
+source pixels are sampled from a smaller level
+of a source pyramid to avoid aliasing.
+-------------------------------------------*/
+void TopView::warpTopImage(Mat &transform_matrix){
+    if (!distCoeffs.empty()) {
+        warpDistortedImage(transform_matrix);
+        return;
+    }
+    
+    Mat Hi = transform_matrix.inv();
+    const double *m = Hi.ptr<double>(0);
+    
+    vector<int> levels(topImage.rows, 0);
+    int maxLevel = 0;
+    
+    for (int y = 0; y < topImage.rows; y++) {
+        if (spans[y][1] <= spans[y][0])
+            continue;
         
-        vector<Point2f> transformed;
-        perspectiveTransform(mouseData->rec, transformed, transform_matrix.inv());
+        float s = std::max(minification(m, spans[y][0], y), minification(m, spans[y][1] - 1, y));
+        if (s >= 2) {
+            levels[y] = std::min(TOPVIEW_MAX_LEVEL, (int)floor(log(s)/log(2.0)));
+            maxLevel = std::max(maxLevel, levels[y]);
+        }
+    }
+    
+    if (maxLevel == 0) {
+        warpPerspectiveFast(image, topImage, transform_matrix, topImage.size(), &spans);
+        return;
+    }
+    
+    vector<Mat> pyramid;
+    buildPyramid(image, pyramid, maxLevel);
+    
+    //one warp per band of rows sharing a level
+    for (int r0 = 0; r0 < topImage.rows; ) {
+        int r1 = r0 + 1;
+        while (r1 < topImage.rows && levels[r1] == levels[r0])
+            r1++;
         
-        source_points[0] = transformed[0];
-        source_points[1] = transformed[2];
-        source_points[2] = transformed[3];
-        source_points[3] = transformed[1];
+        //pyrDown centres sample i of a level on source pixel 2^level * i, no offset unlike a box decimation
+        double s = 1 << levels[r0];
+        Mat up(Matx33d(s, 0, 0, 0, s, 0, 0, 0, 1));
+        Mat shift(Matx33d(1, 0, 0, 0, 1, -r0, 0, 0, 1));
+        Mat H = shift * transform_matrix * up;
         
-        dest_points[0] = Point(0,0);
-        dest_points[1] = Point(topImage.cols, 0);
-        dest_points[2] = Point(0, height);
-        dest_points[3] = Point(topImage.cols, height);
+        vector<Vec2i> bandSpans(spans.begin() + r0, spans.begin() + r1);
+        Mat band = topImage.rowRange(r0, r1);
+        warpPerspectiveFast(pyramid[levels[r0]], band, H, band.size(), &bandSpans);
         
-        transform_matrix = getPerspectiveTransform(source_points, dest_points);
+        r0 = r1;
+    }
+}
+
+
+//ground part of a top-image tile in tile coordinates, empty rows where there is none
+static vector<Vec2i> tileSpans(const vector<Vec2i> &spans, Rect tile){
+    vector<Vec2i> result(tile.height, Vec2i(0, 0));
+    
+    for (int y = 0; y < tile.height; y++) {
+        int r = tile.y + y;
+        if (r < 0 || r >= (int)spans.size())
+            continue;
+        
+        int x0 = std::max(spans[r][0], tile.x), x1 = std::min(spans[r][1], tile.x + tile.width);
+        if (x0 < x1)
+            result[y] = Vec2i(x0 - tile.x, x1 - tile.x);
     }
     
-    transformationMat = transform_matrix.clone();
+    return result;
+}
+
+/* ----------------------------------------
+bounding box of the source pixels needed by a
+tile of the top-image, with the border the
+interpolation reads. Empty if no ground is seen
+through the tile.
+-------------------------------------------*/
+Rect TopView::tileSourceRegion(Rect tile){
+    vector<Vec2i> ground = tileSpans(spans, tile);
+    
+    //the ground in a tile is convex, its end-points per row hold its vertices
+    vector<Point2f> points;
+    for (int y = 0; y < tile.height; y++) {
+        if (ground[y][1] <= ground[y][0])
+            continue;
+        points.push_back(Point2f(tile.x + ground[y][0], tile.y + y));
+        points.push_back(Point2f(tile.x + ground[y][1], tile.y + y));
+    }
+    
+    if (points.empty())
+        return Rect();
+    
+    vector<Point2f> source;
+    perspectiveTransform(points, source, transformationMat.inv());
+    
+    Rect box = boundingRect(source);
+    box = Rect(box.x - 2, box.y - 2, box.width + 4, box.height + 4);
+    
+    return box & Rect(0, 0, image.cols, image.rows);
+}
+
+//pyramid level a tile of the top-image is sampled from, as in warpTopImage
+int TopView::tileLevel(Rect tile){
+    vector<Vec2i> ground = tileSpans(spans, tile);
+    Mat Hi = transformationMat.inv();
+    const double *m = Hi.ptr<double>(0);
+    
+    float s = 1;
+    for (int y = 0; y < tile.height; y++) {
+        if (ground[y][1] > ground[y][0])
+            s = std::max(s, std::max(minification(m, tile.x + ground[y][0], tile.y + y), minification(m, tile.x + ground[y][1] - 1, tile.y + y)));
+    }
     
-    warpPerspective(image, topImage, transform_matrix, Size(topImage.cols, (int)height));
+    return s >= 2 ? std::min(TOPVIEW_MAX_LEVEL, (int)floor(log(s)/log(2.0))) : 0;
 }
 
+/* ----------------------------------------
+warps one tile of the top-image reading only
+"region", the part of the source image at
+"offset" given by tileSourceRegion. Far-field
+tiles are sampled from the region shrunk by a
+power of two, as in warpTopImage.
+-------------------------------------------*/
+void TopView::warpTile(const Mat &region, Point offset, Rect tile, Mat &dst){
+    int scale = 1 << tileLevel(tile);
+    
+    //box filtered level, whole blocks of the region only
+    Mat source = region;
+    if (scale > 1 && region.cols >= scale && region.rows >= scale) {
+        Mat blocks = region(Rect(0, 0, region.cols - region.cols % scale, region.rows - region.rows % scale));
+        resize(blocks, source, Size(blocks.cols/scale, blocks.rows/scale), 0, 0, INTER_AREA);
+    }
+    else
+        scale = 1;
+    
+    warpTileLevel(source, scale, offset, tile, dst);
+}
+
+//warpTile from a source already box filtered by scale x scale blocks, e.g. while it was read
+void TopView::warpTileLevel(const Mat &source, int scale, Point offset, Rect tile, Mat &dst){
+    dst = Mat::zeros(tile.size(), source.type());
+    vector<Vec2i> ground = tileSpans(spans, tile);
+    
+    //block centres, unlike pyrDown levels
+    double c = (scale - 1)/2.0;
+    Mat up(Matx33d(scale, 0, offset.x + c, 0, scale, offset.y + c, 0, 0, 1));
+    Mat shift(Matx33d(1, 0, -tile.x, 0, 1, -tile.y, 0, 0, 1));
+    Mat H = shift * transformationMat * up;
+    
+    warpPerspectiveFast(source, dst, H, dst.size(), &ground);
+}
 
 void mouseCrop(int event, int x, int y, int flags, void* userdata){
     mouseDataCrop *data = (mouseDataCrop *) userdata;
@@ -233,6 +567,11 @@ void mouseCrop(int event, int x, int y, int flags, void* userdata){
         if (data->rec.size() < 2)
             data->rec.push_back(Point(x,y));
     }
+    else if (event == EVENT_RBUTTONDOWN ){
+        //back to the whole top-view
+        //a region without area, the crop is removed
+        data->rec.assign(2, Point2f(x, y));
+    }
     else if (event == EVENT_MOUSEMOVE ){
         data->lastPoint = Point(x,y);
     }
@@ -240,20 +579,49 @@ void mouseCrop(int event, int x, int y, int flags, void* userdata){
 }
 
 void TopView::cropTopView(){
-    namedWindow( mouseData->windowName, WINDOW_AUTOSIZE );
-    setMouseCallback(mouseData->windowName, mouseCrop, (void *)mouseData);
-    
-    if (mouseData->rec.size() == 1) {
-        line(topImage, Point(mouseData->rec[0].x,mouseData->rec[0].y), Point(mouseData->lastPoint.x, mouseData->rec[0].y), Scalar(0,0,255));
-        line(topImage, Point(mouseData->lastPoint.x, mouseData->lastPoint.y), Point(mouseData->lastPoint.x, mouseData->rec[0].y), Scalar(0,0,255));
-        line(topImage, Point(mouseData->lastPoint.x, mouseData->lastPoint.y), Point(mouseData->rec[0].x,mouseData->lastPoint.y), Scalar(0,0,255));
-        line(topImage, Point(mouseData->rec[0].x,mouseData->rec[0].y), Point(mouseData->rec[0].x,mouseData->lastPoint.y), Scalar(0,0,255));
+    cropTopView(topImage, mouseData);
+}
+
+/* ----------------------------------------
+crop of the window showing "shown", the top-
+image or a resized copy of it: two left clicks
+give the corners of the region, kept in ground
+units so that later top-views crop the same
+ground. A right click removes the crop.
+-------------------------------------------*/
+void TopView::cropTopView(Mat &shown, mouseDataCrop *mouse){
+    if (mouse->callbackWindow != mouse->windowName) {
+        namedWindow( mouse->windowName, WINDOW_AUTOSIZE );
+        setMouseCallback(mouse->windowName, mouseCrop, (void *)mouse);
+        mouse->callbackWindow = mouse->windowName;
+    }
+    
+    //corners were clicked on the last top-view shown
+    if (mouse->rec.size() > 1) {
+        vector<Point2f> corners;
+        perspectiveTransform(mouse->rec, corners, Mat(mouse->topToGround));
+        mouse->ground = Rect_<float>(corners[0], corners[1]);
+        mouse->rec.clear();
+    }
+    
+    //window pixels to ground units
+    double s = (double)shown.cols/topSize.width;
+    Mat toTop(Matx33d(1/s, 0, 0, 0, 1/s, 0, 0, 0, 1));
+    Mat topToGround = groundHomography() * transformationMat.inv() * toTop;
+    mouse->topToGround = Matx33d(topToGround.ptr<double>());
+    
+    if (mouse->rec.size() == 1) {
+        line(shown, Point(mouse->rec[0].x,mouse->rec[0].y), Point(mouse->lastPoint.x, mouse->rec[0].y), Scalar(0,0,255));
+        line(shown, Point(mouse->lastPoint.x, mouse->lastPoint.y), Point(mouse->lastPoint.x, mouse->rec[0].y), Scalar(0,0,255));
+        line(shown, Point(mouse->lastPoint.x, mouse->lastPoint.y), Point(mouse->rec[0].x,mouse->lastPoint.y), Scalar(0,0,255));
+        line(shown, Point(mouse->rec[0].x,mouse->rec[0].y), Point(mouse->rec[0].x,mouse->lastPoint.y), Scalar(0,0,255));
     }
 }
 
 void TopView::setOrigin(Point p){
     Point3f P = convertToWorldCoord(Vec3f(0, 0, f));
     O = vecPlaneInter(P, convertToWorldCoord(Vec3f(p.x - ref.x, p.y - ref.y, f)));
+    lutDirty = true;
 }
 
 void TopView::setScaleFactor(Point a, Point b, float dist){
@@ -263,9 +631,108 @@ void TopView::setScaleFactor(Point a, Point b, float dist){
     float d = pointDistance(A, B);
     
     sf = d/dist;
+    lutDirty = true;
+}
+
+/* ----------------------------------------
+image pixels to ground plane coordinates, after
+setOrigin and setScaleFactor. Each point hits
+the ground through the camera ray: a fixed 3x3
+homography once the calibration is known.
+-------------------------------------------*/
+Mat TopView::groundHomography(){
+    Point3f P = convertToWorldCoord(Point3f(0, 0, f));
+    
+    Mat toRay(Matx33d(1, 0, -ref.x, 0, 1, -ref.y, 0, 0, f));
+    Mat toGround(Matx33d(P.z, 0, -O.x, 0, P.z, -O.y, 0, 0, sf));
+    
+    Mat Mi64;
+    Mi.convertTo(Mi64, CV_64F);
+    
+    return toGround * Mi64 * toRay;
+}
+
+//rebuilds the ground lookup table if the calibration, origin or scale changed since it was built
+void TopView::updateGroundTable(){
+    Mat G = groundHomography();
+    groundCache *cache = lutCache;
+    lutDirty = false;
+    
+    if (!cache->G.empty() && cache->step == lutStep && cache->size == image.size()
+        && norm(G, cache->G, NORM_INF) <= 1e-9 * norm(G, NORM_INF))
+        return;
+    
+    int rows = (image.rows + lutStep - 1)/lutStep + 1;
+    int cols = (image.cols + lutStep - 1)/lutStep + 1;
+    cache->table.create(rows, cols, CV_32FC2);
+    
+    //sign of W at every node, the horizon runs between nodes of opposite sign
+    Mat sides(rows, cols, CV_8S);
+    
+    const double *g = G.ptr<double>(0);
+    for (int i = 0; i < rows; i++) {
+        Vec2f *row = cache->table.ptr<Vec2f>(i);
+        schar *side = sides.ptr<schar>(i);
+        double y = i * lutStep;
+        
+        for (int j = 0; j < cols; j++) {
+            double x = j * lutStep;
+            double W = g[6]*x + g[7]*y + g[8];
+            double w = W != 0 ? 1/W : 0;
+            row[j] = Vec2f((float)((g[0]*x + g[1]*y + g[2])*w), (float)((g[3]*x + g[4]*y + g[5])*w));
+            side[j] = W > 0 ? 1 : (W < 0 ? -1 : 0);
+        }
+    }
+    
+    //cells with all four nodes on one side of the horizon can be interpolated
+    cache->cells.create(rows - 1, cols - 1, CV_8U);
+    for (int i = 0; i < rows - 1; i++) {
+        const schar *s0 = sides.ptr<schar>(i), *s1 = sides.ptr<schar>(i + 1);
+        uchar *cell = cache->cells.ptr<uchar>(i);
+        
+        for (int j = 0; j < cols - 1; j++)
+            cell[j] = s0[j] != 0 && s0[j] == s0[j + 1] && s0[j] == s1[j] && s0[j] == s1[j + 1];
+    }
+    
+    cache->G = G;
+    cache->step = lutStep;
+    cache->size = image.size();
+}
+
+/* ----------------------------------------
+ground lookup table of the image, with a node
+every "step" pixels (1 for every pixel) and
+bilinear interpolation in between. The table
+is kept in the cache, so it is built once for
+a still camera. 0 turns it off.
+-------------------------------------------*/
+void TopView::setGroundLUT(int step, groundCache *cache){
+    lutStep = cache ? std::max(0, step) : 0;
+    lutCache = cache;
+    lutDirty = true;
 }
 
 Point2f TopView::toGroundPlaneCoord(Point a){
+    if (lutStep > 0 && a.x >= 0 && a.y >= 0 && a.x <= image.cols && a.y <= image.rows) {
+        //checked once after the mapping changed, then only the table is read
+        if (lutDirty)
+            updateGroundTable();
+        
+        const Mat &table = lutCache->table;
+        int j = std::min(a.x/lutStep, table.cols - 2), i = std::min(a.y/lutStep, table.rows - 2);
+        
+        //cells across the horizon are not interpolated
+        if (lutCache->cells.at<uchar>(i, j)) {
+            float fx = (float)(a.x - j*lutStep)/lutStep, fy = (float)(a.y - i*lutStep)/lutStep;
+            
+            const Vec2f *r0 = table.ptr<Vec2f>(i);
+            const Vec2f *r1 = table.ptr<Vec2f>(i + 1);
+            
+            Vec2f p = (r0[j]*(1 - fx) + r0[j + 1]*fx)*(1 - fy) + (r1[j]*(1 - fx) + r1[j + 1]*fx)*fy;
+            return Point2f(p[0], p[1]);
+        }
+    }
+    
     Point3f P = convertToWorldCoord(Point3f(0, 0, f));
     Point3f A = vecPlaneInter(P, convertToWorldCoord(Vec3f(a.x - ref.x, a.y - ref.y, f)));
     
@@ -276,9 +743,79 @@ Point2f TopView::toGroundPlaneCoord(Point a){
     return Point2f(A.x, A.y);
 }
 
+//ground plane coordinates of many image points, one homography for all of them
+vector<Point2f> TopView::toGroundPlaneCoord(vector<Point2f> a){
+    vector<Point2f> result;
+    if (!a.empty())
+        perspectiveTransform(a, result, groundHomography());
+    
+    return result;
+}
+
 vector<Point2f> TopView::toTopViewCoordinates(vector<Point2f> a){
     vector<Point2f> result;
     perspectiveTransform(a, result, transformationMat);
     
     return result;
-}
\ No newline at end of file
+}
+
+//mask of the top-view pixels that see the ground plane
+Mat TopView::getValidMask(){
+    Mat mask = Mat::zeros((int)spans.size(), topSize.width, CV_8UC1);
+    
+    for (int y = 0; y < (int)spans.size() && y < mask.rows; y++) {
+        if (spans[y][1] > spans[y][0])
+            mask.row(y).colRange(spans[y][0], spans[y][1]).setTo(255);
+    }
+    
+    return mask;
+}
+
+/* ----------------------------------------
+the vanishing points and the homography are
+in undistorted coordinates, lens distortion
+and perspective are undone in a single remap
+from the distorted frame. The remap tables
+are kept in the cache while the homography
+does not change.
+-------------------------------------------*/
+void TopView::warpDistortedImage(Mat &transform_matrix){
+    remapCache local;
+    remapCache *cache = distCache ? distCache : &local;
+    
+    if (cache->H.empty() || cache->size != topImage.size()
+        || norm(transform_matrix, cache->H, NORM_INF) > 1e-9 * norm(transform_matrix, NORM_INF)) {
+        
+        Mat K(Matx33d(distFocal, 0, ref.x, 0, distFocal, ref.y, 0, 0, 1));
+        undistortWarpMaps(transform_matrix, topImage.size(), spans, K, distCoeffs, cache->map1, cache->map2);
+        
+        cache->H = transform_matrix.clone();
+        cache->size = topImage.size();
+    }
+    
+    remap(image, topImage, cache->map1, cache->map2, INTER_LINEAR, BORDER_CONSTANT);
+}
+
+//lens distortion of the input image, focal is the focal length in pixels the coefficients refer to
+void TopView::setDistortion(Mat coeffs, float focal, remapCache *cache){
+    distCoeffs = coeffs;
+    distFocal = focal;
+    distCache = cache;
+}
+
+//chroma planes of a planar YUV 4:2:0 input, the image given to the constructor is then its luma plane
+void TopView::setChroma(Mat u, Mat v){
+    chromaU = u;
+    chromaV = v;
+}
+
+//top-image size in pixels, the ground footprint is fitted into it
+void TopView::setOutputSize(Size size){
+    outputSize = size;
+    gsd = 0;
+}
+
+//ground units per top-image pixel, in the units given to setScaleFactor
+void TopView::setGroundSampling(float unitsPerPixel){
+    gsd = unitsPerPixel;
+}
@@ -18,24 +18,62 @@
 using namespace cv;
 using namespace std;
 
+//ground region the top-view is cropped to, kept across frames and top-views
 typedef struct mouseDataCrop{
     Point lastPoint;
-    vector<Point2f> rec;
+    vector<Point2f> rec;        //corners clicked on the shown top-view, at most two
     string windowName;
+    string callbackWindow;      //window the mouse callback is set on
+    Rect_<float> ground;        //in toGroundPlaneCoord units, empty for no crop
+    Matx33d topToGround;        //of the last top-view shown, for the clicked corners
 }mouseDataCrop;
 
+typedef struct remapCache{
+    Mat H;          //homography the maps were built for
+    Size size;
+    Mat map1, map2;
+}remapCache;
+
+typedef struct groundCache{
+    Mat G;          //image to ground homography the table was built for
+    Size size;
+    int step;       //image pixels between table nodes
+    Mat table;      //ground X, Y of every node, CV_32FC2
+    Mat cells;      //CV_8U, 1 for cells whose four nodes are on the ground side of the horizon
+}groundCache;
+
 class TopView{
 public:
     Mat topImage;
+    Mat topImageI420; //whole top-image when chroma planes are set, topImage is then its luma plane
     
     TopView(Mat img, Point2f vp1, Point2f vp2, mouseDataCrop *mouse);
-    void drawAxis(Mat output, Point p);
+    void drawAxis(Mat output, Point p, float scale = 1);
     void setOrigin(Point p);
     void setScaleFactor(Point a, Point b, float dist);
+    void setOutputSize(Size size);
+    void setGroundSampling(float unitsPerPixel);
+    void setDistortion(Mat coeffs, float focal, remapCache *cache);
+    void setChroma(Mat u, Mat v);
+    void setGroundLUT(int step, groundCache *cache);
+    void setTopBuffer(Mat buffer);
     Point2f toGroundPlaneCoord(Point a);
+    vector<Point2f> toGroundPlaneCoord(vector<Point2f> a);
+    void computeTransformation();
     void generateTopImage();
+    Rect tileSourceRegion(Rect tile);
+    int tileLevel(Rect tile);
+    void warpTile(const Mat &region, Point offset, Rect tile, Mat &dst);
+    void warpTileLevel(const Mat &source, int scale, Point offset, Rect tile, Mat &dst);
     void cropTopView();
+    void cropTopView(Mat &shown, mouseDataCrop *mouse);
     vector<Point2f> toTopViewCoordinates(vector<Point2f> a);
+    Mat getValidMask();
+    Mat getTransformation();
+    Size getTopSize();
+    float getFocal();
+    void setFocal(float focal);
+    Matx33f getRotation();
     
 private:
     Mat image;
@@ -48,6 +86,18 @@ private:
     float sf; //scale factor
     mouseDataCrop *mouseData;
     Mat transformationMat;
+    vector<Vec2i> spans; //top-view columns that see the ground, per row
+    Size outputSize;
+    Size topSize;   //size of the last top-image, may be shorter than outputSize when cropped
+    float gsd; //ground sampling distance, 0 to use outputSize
+    Mat distCoeffs; //lens distortion (k1, k2, p1, p2, k3), empty if none
+    float distFocal;
+    remapCache *distCache;
+    Mat chromaU, chromaV; //planes of an I420 input, empty for BGR or gray
+    Mat topBuffer; //reused for the top-image when it fits, empty for a new one
+    int lutStep; //ground lookup table node spacing, 0 for none
+    groundCache *lutCache;
+    bool lutDirty; //mapping changed since the table was last checked
     
     Vec2f verticalAxis();
     void ComputeUVW();
@@ -55,6 +105,11 @@ private:
     Point3f convertToCamCoord(Point3f A);
     Point3f convertToWorldCoord(Point3f A);
     Point IPProjection(Point3f P);
+    void warpTopImage(Mat &transform_matrix);
+    void warpDistortedImage(Mat &transform_matrix);
+    void warpChroma(Mat &transform_matrix);
+    Mat groundHomography();
+    void updateGroundTable();
     
 
 };
@@ -0,0 +1,259 @@
+//  Plane Projection
+//  Y4MReader.cpp
+//
+//  University of Bristol
+//
+//  Created by Henrique Grandinetti on 13/07/15.
+//  henriquegrandinetti@gmail.com
+
+#include "Y4MReader.h"
+
+#include <algorithm>
+#include <string.h>
+#include <stdlib.h>
+
+#ifndef WIN32
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+Y4MReader::Y4MReader(){
+    data = 0;
+    length = 0;
+    mono = false;
+    frameRate = 0;
+    next = 0;
+}
+
+Y4MReader::~Y4MReader(){
+    release();
+}
+
+//YUV4MPEG2 file, size, frame rate and colour space come from its header
+bool Y4MReader::open(const string &fileName){
+    release();
+
+    if (!map(fileName))
+        return false;
+
+    if (!parseHeader()) {
+        release();
+        return false;
+    }
+
+    prefetch(0);
+    return true;
+}
+
+//headerless raw I420 file of frames of the given size
+bool Y4MReader::open(const string &fileName, Size frameSize){
+    release();
+
+    if (frameSize.width <= 0 || frameSize.height <= 0 || (frameSize.width & 1) || (frameSize.height & 1)) {
+        printf("ERROR: raw I420 frames need an even, positive size\n");
+        return false;
+    }
+
+    if (!map(fileName))
+        return false;
+
+    size = frameSize;
+    mono = false;
+    frameRate = 0;
+
+    size_t frameBytes = (size_t)size.width*size.height*3/2;
+    for (size_t pos = 0; pos + frameBytes <= length; pos += frameBytes)
+        offsets.push_back(pos);
+
+    prefetch(0);
+    return true;
+}
+
+void Y4MReader::release(){
+#ifndef WIN32
+    if (data)
+        munmap(data, length);
+#endif
+    data = 0;
+    length = 0;
+    offsets.clear();
+    next = 0;
+}
+
+bool Y4MReader::isOpened(){
+    return data != 0;
+}
+
+//next frame, an empty frame at the end of the file
+bool Y4MReader::read(Mat &frame){
+    return read(next, frame);
+}
+
+//frame at a given index, no data is copied
+bool Y4MReader::read(int index, Mat &frame){
+    if (index < 0 || index >= (int)offsets.size()) {
+        frame = Mat();
+        return false;
+    }
+
+    int rows = mono ? size.height : size.height*3/2;
+    frame = Mat(rows, size.width, CV_8UC1, data + offsets[index]);
+
+    next = index + 1;
+    prefetch(next);
+
+    return true;
+}
+
+void Y4MReader::seek(int index){
+    next = index;
+    prefetch(next);
+}
+
+int Y4MReader::numFrames(){
+    return (int)offsets.size();
+}
+
+Size Y4MReader::frameSize(){
+    return size;
+}
+
+double Y4MReader::fps(){
+    return frameRate;
+}
+
+bool Y4MReader::map(const string &fileName){
+#ifdef WIN32
+    printf("ERROR: raw video input needs a POSIX system\n");
+    return false;
+#else
+    int fd = ::open(fileName.c_str(), O_RDONLY);
+    if (fd < 0) {
+        printf("ERROR: can not open raw video file %s\n", fileName.c_str());
+        return false;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size == 0) {
+        close(fd);
+        printf("ERROR: can not read raw video file %s\n", fileName.c_str());
+        return false;
+    }
+
+    //frames are only read, a write into one faults instead of going unnoticed
+    void *p = mmap(0, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+
+    if (p == MAP_FAILED) {
+        printf("ERROR: can not map raw video file %s\n", fileName.c_str());
+        return false;
+    }
+
+    data = (uchar *)p;
+    length = (size_t)st.st_size;
+
+    madvise(data, length, MADV_SEQUENTIAL);
+    return true;
+#endif
+}
+
+/* ----------------------------------------
+parses the stream header and indexes the
+frames. Every frame has its own header line
+("FRAME" and optional parameters), so offsets
+are found by walking the headers once.
+-------------------------------------------*/
+bool Y4MReader::parseHeader(){
+    const char *magic = "YUV4MPEG2 ";
+    const char *begin = (const char *)data;
+
+    if (length < strlen(magic) || memcmp(begin, magic, strlen(magic)) != 0) {
+        printf("ERROR: not a YUV4MPEG2 file\n");
+        return false;
+    }
+
+    const char *end = (const char *)memchr(begin, '\n', length);
+    if (!end) {
+        printf("ERROR: truncated YUV4MPEG2 header\n");
+        return false;
+    }
+
+    string header(begin + strlen(magic), end);
+    size = Size(0, 0);
+    mono = false;
+    frameRate = 0;
+
+    //space separated tags, a letter followed by its value
+    size_t pos = 0;
+    while (pos < header.size()) {
+        size_t stop = header.find(' ', pos);
+        if (stop == string::npos)
+            stop = header.size();
+
+        string tag = header.substr(pos, stop - pos);
+        if (!tag.empty()) {
+            string value = tag.substr(1);
+
+            if (tag[0] == 'W')
+                size.width = atoi(value.c_str());
+            else if (tag[0] == 'H')
+                size.height = atoi(value.c_str());
+            else if (tag[0] == 'F') {
+                int num = 0, den = 0;
+                if (sscanf(value.c_str(), "%d:%d", &num, &den) == 2 && den > 0)
+                    frameRate = (double)num/den;
+            }
+            else if (tag[0] == 'C') {
+                if (value == "mono")
+                    mono = true;
+                else if (value.compare(0, 3, "420") != 0) {
+                    printf("ERROR: YUV4MPEG2 colour space C%s not supported, only 4:2:0 and mono\n", value.c_str());
+                    return false;
+                }
+            }
+        }
+        pos = stop + 1;
+    }
+
+    if (size.width <= 0 || size.height <= 0 || (!mono && ((size.width & 1) || (size.height & 1)))) {
+        printf("ERROR: YUV4MPEG2 frame size %dx%d not supported\n", size.width, size.height);
+        return false;
+    }
+
+    size_t frameBytes = mono ? (size_t)size.width*size.height : (size_t)size.width*size.height*3/2;
+    size_t p = (end - begin) + 1;
+
+    while (p + 5 <= length && memcmp(data + p, "FRAME", 5) == 0) {
+        const uchar *nl = (const uchar *)memchr(data + p, '\n', length - p);
+        if (!nl)
+            break;
+
+        size_t offset = (nl - data) + 1;
+        if (offset + frameBytes > length)
+            break;
+
+        offsets.push_back(offset);
+        p = offset + frameBytes;
+    }
+
+    return true;
+}
+
+//asks the kernel to start reading the frames that follow
+void Y4MReader::prefetch(int index){
+#ifndef WIN32
+    if (!data || index < 0 || index >= (int)offsets.size())
+        return;
+
+    int last = std::min(index + Y4M_READAHEAD, (int)offsets.size()) - 1;
+    size_t frameBytes = mono ? (size_t)size.width*size.height : (size_t)size.width*size.height*3/2;
+
+    size_t page = (size_t)sysconf(_SC_PAGESIZE);
+    size_t start = offsets[index] & ~(page - 1);
+    size_t stop = offsets[last] + frameBytes;
+
+    madvise(data + start, stop - start, MADV_WILLNEED);
+#endif
+}
@@ -0,0 +1,64 @@
+//  Plane Projection
+//  Y4MReader.h
+//
+//  University of Bristol
+//
+//  Created by Henrique Grandinetti on 13/07/15.
+//  henriquegrandinetti@gmail.com
+
+#ifndef __ACCTVP__Y4MReader__
+#define __ACCTVP__Y4MReader__
+
+#include <stdio.h>
+
+#include "opencv2/core/core.hpp"
+
+using namespace cv;
+using namespace std;
+
+#define Y4M_READAHEAD   4   //frames prefetched ahead of the last one read
+
+/* ----------------------------------------
+reads YUV4MPEG2 files or headerless raw I420
+files through a read-only file mapping. Frames
+are Mat headers into the mapping, I420 frames
+are a single channel image 3/2 the frame height
+(as CV_YUV2BGR_I420 expects) and mono frames are
+a grayscale image. The mapping can not be
+written, draw on a copy of a frame.
+-------------------------------------------*/
+class Y4MReader{
+public:
+    Y4MReader();
+    ~Y4MReader();
+
+    bool open(const string &fileName);
+    bool open(const string &fileName, Size size);
+    void release();
+    bool isOpened();
+
+    bool read(Mat &frame);
+    bool read(int index, Mat &frame);
+    void seek(int index);
+
+    int numFrames();
+    Size frameSize();
+    double fps();
+
+private:
+    uchar *data;
+    size_t length;
+
+    Size size;
+    bool mono;
+    double frameRate;
+
+    vector<size_t> offsets; //start of every frame's pixel data
+    int next;
+
+    bool map(const string &fileName);
+    bool parseHeader();
+    void prefetch(int index);
+};
+
+#endif
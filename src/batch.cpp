@@ -0,0 +1,150 @@
+//  Plane Projection
+//  batch.cpp
+//
+//  University of Bristol
+//
+//  Created by Henrique Grandinetti on 13/07/15.
+//  henriquegrandinetti@gmail.com
+
+#include "batch.h"
+#include "ThreadPool.h"
+
+#include "opencv2/highgui/highgui.hpp"
+
+#include <algorithm>
+#include <fstream>
+#include <ctype.h>
+
+//file name without its directory
+static string baseName(const string &path){
+    size_t slash = path.find_last_of("/\\");
+    return slash == string::npos ? path : path.substr(slash + 1);
+}
+
+/* ----------------------------------------
+takes the next image of the batch until none
+is left: decode, calibrate, warp and encode.
+Every image has its own session, images do
+not share any calibration.
+-------------------------------------------*/
+class imageTask : public poolTask{
+public:
+    imageTask(const vector<string> &images, vector<sessionResult> &results, std::atomic<int> &next, const sessionParams &params, const batchOptions &options) :
+        images(images), results(results), next(next), params(params), options(options){}
+
+    virtual void run(){
+        for (int i = next++; i < (int)images.size(); i = next++) {
+            Mat img = imread(images[i]);
+
+            results[i].valid = false;
+            if (img.empty()) {
+                printf("ERROR: can not read %s\n", images[i].c_str());
+                continue;
+            }
+
+            ACCTVPSession session(params);
+            if (!session.processFrame(matFrameBuffer(img, img.size()), results[i]))
+                continue;
+
+            if (!options.outputDir.empty())
+                imwrite(options.outputDir + "/" + baseName(images[i]), session.topView()->topImage);
+        }
+    }
+
+private:
+    const vector<string> &images;
+    vector<sessionResult> &results;
+    std::atomic<int> &next;
+    sessionParams params;
+    batchOptions options;
+};
+
+//image files of a directory, sorted by name
+vector<string> listImages(const string &dir){
+    const char *extensions[] = {".jpg", ".jpeg", ".png", ".bmp", ".tif", ".tiff", ".ppm", ".pgm"};
+
+    vector<String> files;
+    glob(dir, files, false);
+
+    vector<string> images;
+    for (size_t i = 0; i < files.size(); i++) {
+        string name = files[i];
+        size_t dot = name.find_last_of('.');
+        if (dot == string::npos)
+            continue;
+
+        string ext = name.substr(dot);
+        for (size_t k = 0; k < ext.size(); k++)
+            ext[k] = (char)tolower(ext[k]);
+
+        for (size_t k = 0; k < sizeof(extensions)/sizeof(extensions[0]); k++) {
+            if (ext == extensions[k]) {
+                images.push_back(name);
+                break;
+            }
+        }
+    }
+
+    std::sort(images.begin(), images.end());
+    return images;
+}
+
+/* ----------------------------------------
+calibrates and warps every image on one pool
+without display, then writes the calibration
+table in the order of the list.
+-------------------------------------------*/
+int runImageBatch(const vector<string> &images, const sessionParams &params, const batchOptions &options){
+    sessionParams imageParams = params;
+    imageParams.still = false;
+    imageParams.overlay = OVERLAY_NONE;
+    imageParams.topImage = !options.outputDir.empty();
+    imageParams.detection.tileThreshold = 0;
+
+    setNumThreads(1);
+    ThreadPool pool(options.numThreads);
+
+    vector<sessionResult> results(images.size());
+    std::atomic<int> next(0);
+
+    printf("Processing %d images on %d threads\n", (int)images.size(), pool.numThreads());
+
+    int64 start = getTickCount();
+
+    //one image worker per thread, decode, compute and encode of different images run at once
+    int numTasks = std::min((int)images.size(), pool.numThreads());
+    vector<imageTask *> tasks;
+    for (int i = 0; i < numTasks; i++) {
+        tasks.push_back(new imageTask(images, results, next, imageParams, options));
+        pool.submit(tasks.back());
+    }
+    pool.wait();
+
+    double seconds = (getTickCount() - start)/getTickFrequency();
+
+    for (size_t i = 0; i < tasks.size(); i++)
+        delete tasks[i];
+
+    int calibrated = 0;
+    for (size_t i = 0; i < results.size(); i++)
+        calibrated += results[i].valid;
+
+    if (!options.calibLog.empty()) {
+        ofstream log(options.calibLog.c_str());
+        log << "image,valid,u_x,u_y,v_x,v_y,focal\n";
+
+        for (size_t i = 0; i < results.size(); i++) {
+            const sessionResult &r = results[i];
+            log << images[i] << "," << r.valid;
+            if (r.valid)
+                log << "," << r.vps[0] << "," << r.vps[1] << "," << r.vps[2] << "," << r.vps[3] << "," << r.focal;
+            else
+                log << ",,,,,";
+            log << "\n";
+        }
+    }
+
+    printf("%d images, %d calibrated, %.2f s, %.1f images/s\n", (int)images.size(), calibrated, seconds, images.size()/std::max(seconds, 1e-9));
+
+    return 0;
+}
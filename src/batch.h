@@ -0,0 +1,30 @@
+//  Plane Projection
+//  batch.h
+//
+//  University of Bristol
+//
+//  Created by Henrique Grandinetti on 13/07/15.
+//  henriquegrandinetti@gmail.com
+
+#ifndef __ACCTVP__batch__
+#define __ACCTVP__batch__
+
+#include <stdio.h>
+
+#include "opencv2/core/core.hpp"
+
+#include "ACCTVPSession.h"
+
+using namespace cv;
+using namespace std;
+
+typedef struct batchOptions{
+    int numThreads;     //pool size, 0 for one per core
+    string outputDir;   //top-view images, none written if empty
+    string calibLog;    //per image calibration table, none if empty
+}batchOptions;
+
+vector<string> listImages(const string &dir);
+int runImageBatch(const vector<string> &images, const sessionParams &params, const batchOptions &options);
+
+#endif
@@ -0,0 +1,172 @@
+//  Plane Projection
+//  calibTrack.cpp
+//
+//  University of Bristol
+//
+//  Created by Henrique Grandinetti on 13/07/15.
+//  henriquegrandinetti@gmail.com
+
+#include "calibTrack.h"
+
+#include <string.h>
+
+#ifndef WIN32
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+CalibTrack::CalibTrack(){
+    file = 0;
+    data = 0;
+    length = 0;
+    recordSize = sizeof(calibRecord);
+    count = 0;
+}
+
+CalibTrack::~CalibTrack(){
+    release();
+}
+
+//new track for frames of frameSize, replaces an existing file
+bool CalibTrack::create(const string &fileName, Size frameSize){
+    release();
+
+    file = fopen(fileName.c_str(), "wb");
+    if (!file) {
+        printf("ERROR: can not create %s\n", fileName.c_str());
+        return false;
+    }
+
+    calibTrackHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, CALIB_TRACK_MAGIC, sizeof(header.magic));
+    header.version = CALIB_TRACK_VERSION;
+    header.recordSize = sizeof(calibRecord);
+    header.width = frameSize.width;
+    header.height = frameSize.height;
+
+    fwrite(&header, sizeof(header), 1, file);
+
+    size = frameSize;
+    recordSize = sizeof(calibRecord);
+    count = 0;
+    return true;
+}
+
+//record of frame index, frames never written read back as not valid
+bool CalibTrack::write(int index, const sessionResult &result){
+    calibRecord record;
+    memset(&record, 0, sizeof(record));
+    record.frame = index;
+    record.valid = result.valid;
+
+    if (result.valid) {
+        for (int i = 0; i < 4; i++)
+            record.vps[i] = result.vps[i];
+        record.focal = result.focal;
+        for (int i = 0; i < 9; i++) {
+            record.rotation[i] = result.rotation.val[i];
+            record.homography[i] = result.homography.val[i];
+        }
+        record.topWidth = result.topSize.width;
+        record.topHeight = result.topSize.height;
+    }
+
+    std::lock_guard<std::mutex> guard(lock);
+    if (!file)
+        return false;
+
+    fseek(file, (long)(sizeof(calibTrackHeader) + (size_t)index*recordSize), SEEK_SET);
+    count = std::max(count, index + 1);
+
+    return fwrite(&record, sizeof(record), 1, file) == 1;
+}
+
+//maps an existing track for reading
+bool CalibTrack::open(const string &fileName){
+    release();
+
+#ifdef WIN32
+    printf("ERROR: calibration tracks are read on POSIX systems only\n");
+    return false;
+#else
+    int fd = ::open(fileName.c_str(), O_RDONLY);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(calibTrackHeader)) {
+        if (fd >= 0)
+            close(fd);
+        printf("ERROR: can not open %s\n", fileName.c_str());
+        return false;
+    }
+
+    void *p = mmap(0, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+
+    if (p == MAP_FAILED) {
+        printf("ERROR: can not map %s\n", fileName.c_str());
+        return false;
+    }
+
+    data = (uchar *)p;
+    length = (size_t)st.st_size;
+
+    //newer versions may only append fields to a record
+    const calibTrackHeader *header = (const calibTrackHeader *)data;
+    if (memcmp(header->magic, CALIB_TRACK_MAGIC, sizeof(header->magic)) != 0 || header->recordSize < (int32_t)sizeof(calibRecord)) {
+        printf("ERROR: %s is not a calibration track\n", fileName.c_str());
+        release();
+        return false;
+    }
+
+    size = Size(header->width, header->height);
+    recordSize = header->recordSize;
+    count = (int)((length - sizeof(calibTrackHeader))/recordSize);
+
+    madvise(data, length, MADV_RANDOM);
+    return true;
+#endif
+}
+
+//record of frame index, 0 past the end of the track
+const calibRecord *CalibTrack::record(int index){
+    if (!data || index < 0 || index >= count)
+        return 0;
+
+    return (const calibRecord *)(data + sizeof(calibTrackHeader) + (size_t)index*recordSize);
+}
+
+void CalibTrack::release(){
+    if (file)
+        fclose(file);
+    file = 0;
+
+#ifndef WIN32
+    if (data)
+        munmap(data, length);
+#endif
+    data = 0;
+    length = 0;
+    count = 0;
+}
+
+bool CalibTrack::isOpened(){
+    return file || data;
+}
+
+int CalibTrack::numFrames(){
+    return count;
+}
+
+Size CalibTrack::frameSize(){
+    return size;
+}
+
+//vanishing points of a record, (-1, -1, -1, -1) for a missing or not valid one
+Vec4f recordVanishingPoints(const calibRecord *record){
+    if (!record || !record->valid)
+        return Vec4f(-1, -1, -1, -1);
+
+    return Vec4f(record->vps[0], record->vps[1], record->vps[2], record->vps[3]);
+}
@@ -0,0 +1,81 @@
+//  Plane Projection
+//  calibTrack.h
+//
+//  University of Bristol
+//
+//  Created by Henrique Grandinetti on 13/07/15.
+//  henriquegrandinetti@gmail.com
+
+#ifndef __ACCTVP__calibTrack__
+#define __ACCTVP__calibTrack__
+
+#include <stdio.h>
+#include <stdint.h>
+#include <mutex>
+
+#include "opencv2/core/core.hpp"
+
+#include "ACCTVPSession.h"
+
+using namespace cv;
+using namespace std;
+
+#define CALIB_TRACK_MAGIC       "ACCTVPCT"
+#define CALIB_TRACK_VERSION     1
+
+typedef struct calibTrackHeader{
+    char magic[8];
+    int32_t version;
+    int32_t recordSize;     //bytes of one calibRecord
+    int32_t width, height;  //frame size the records refer to
+    int32_t reserved[2];
+}calibTrackHeader;
+
+//one frame of the track, at a fixed offset given by its index
+typedef struct calibRecord{
+    int32_t frame;
+    int32_t valid;          //the fields below are set only for valid frames
+    float vps[4];           //frame pixels
+    float focal;            //frame pixels
+    float rotation[9];      //row major, rows are the ground axes u, v and the normal w
+    double homography[9];   //row major, frame pixels to top-view pixels
+    int32_t topWidth, topHeight;
+}calibRecord;
+
+/* ----------------------------------------
+per frame calibration file of fixed size
+records. Written in any frame order by one or
+several threads, read back through a read-only
+mapping so that any frame is one lookup.
+-------------------------------------------*/
+class CalibTrack{
+public:
+    CalibTrack();
+    ~CalibTrack();
+
+    bool create(const string &fileName, Size frameSize);
+    bool write(int index, const sessionResult &result);
+
+    bool open(const string &fileName);
+    const calibRecord *record(int index);
+
+    void release();
+    bool isOpened();
+    int numFrames();
+    Size frameSize();
+
+private:
+    FILE *file;         //track being written
+    std::mutex lock;
+
+    uchar *data;        //track being read
+    size_t length;
+    size_t recordSize;
+
+    Size size;
+    int count;
+};
+
+Vec4f recordVanishingPoints(const calibRecord *record);
+
+#endif
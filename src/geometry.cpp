@@ -8,6 +8,8 @@
 
 #include "geometry.h"
 
+#include "opencv2/imgproc/imgproc.hpp"
+
 #include <iostream>
 
 void normalize_vec(Vec3f a){
@@ -153,4 +155,73 @@ Vec2f meanSegmentIntersections(vector<Vec4f> segments){
     mean /= (int)intersections.size();
     
     return mean;
-}
\ No newline at end of file
+}
+
+//part of a polygon on the side normal.p >= c of a line, Sutherland-Hodgman with one edge
+vector<Point2f> clipPolygon(const vector<Point2f> &polygon, Point2f normal, float c){
+    vector<Point2f> result;
+    int n = polygon.size();
+    
+    for (int i = 0; i < n; i++) {
+        Point2f p = polygon[i];
+        Point2f q = polygon[(i + 1) % n];
+        float dp = normal.dot(p) - c, dq = normal.dot(q) - c;
+        
+        if (dp >= 0)
+            result.push_back(p);
+        if ((dp >= 0) != (dq >= 0))
+            result.push_back(p + (q - p)*(dp/(dp - dq)));
+    }
+    
+    return result;
+}
+
+//columns [start, end) covered by the convex hull of a polygon in each row of an image
+void polygonSpans(vector<Point2f> polygon, Size size, vector<Vec2i> &spans){
+    vector<Point2f> hull;
+    convexHull(polygon, hull);
+    
+    spans.assign(size.height, Vec2i(0, 0));
+    
+    int n = hull.size();
+    if (n < 3)
+        return;
+    
+    float ymin = hull[0].y, ymax = hull[0].y;
+    for (int i = 1; i < n; i++) {
+        ymin = std::min(ymin, hull[i].y);
+        ymax = std::max(ymax, hull[i].y);
+    }
+    
+    //one pixel margin, border pixels are still blended by the bilinear interpolation
+    int first = std::max(0, cvFloor(ymin) - 1);
+    int last = std::min(size.height - 1, cvCeil(ymax) + 1);
+    
+    for (int y = first; y <= last; y++) {
+        float yy = std::min(std::max((float)y, ymin), ymax);
+        float xmin = FLT_MAX, xmax = -FLT_MAX;
+        
+        for (int i = 0; i < n; i++) {
+            Point2f p = hull[i];
+            Point2f q = hull[(i + 1) % n];
+            
+            if ((yy < p.y && yy < q.y) || (yy > p.y && yy > q.y))
+                continue;
+            
+            if (p.y == q.y) {
+                xmin = std::min(xmin, std::min(p.x, q.x));
+                xmax = std::max(xmax, std::max(p.x, q.x));
+            }
+            else {
+                float x = p.x + (yy - p.y)*(q.x - p.x)/(q.y - p.y);
+                xmin = std::min(xmin, x);
+                xmax = std::max(xmax, x);
+            }
+        }
+        
+        int x0 = std::max(0, cvFloor(xmin) - 1);
+        int x1 = std::min(size.width, cvCeil(xmax) + 2);
+        if (x0 < x1)
+            spans[y] = Vec2i(x0, x1);
+    }
+}
@@ -29,5 +29,7 @@ float length(Vec2f A);
 Point3f vecPlaneInter(Vec3f p, Point3f P);
 void fitQuadRec(Point2f src[4], Point2f dst[4], Size size);
 Vec2f meanSegmentIntersections(vector<Vec4f> segments);
+vector<Point2f> clipPolygon(const vector<Point2f> &polygon, Point2f normal, float c);
+void polygonSpans(vector<Point2f> polygon, Size size, vector<Vec2i> &spans);
 
 #endif
\ No newline at end of file
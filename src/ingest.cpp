@@ -0,0 +1,139 @@
+//  Plane Projection
+//  ingest.cpp
+//
+//  University of Bristol
+//
+//  Created by Henrique Grandinetti on 13/07/15.
+//  henriquegrandinetti@gmail.com
+
+#include "ingest.h"
+#include "ThreadPool.h"
+
+#include "opencv2/imgproc/imgproc.hpp"
+
+//BT.601 luma weights in 14 bit fixed point, as used by cvtColor
+#define LUMA_B  1868
+#define LUMA_G  9617
+#define LUMA_R  4899
+#define LUMA_BITS   14
+
+class BoxGray : public ParallelLoopBody{
+public:
+    BoxGray(const Mat &src, Mat &gray) : src(src), gray(gray){
+        xofs.resize(gray.cols + 1);
+        for (int x = 0; x <= gray.cols; x++)
+            xofs[x] = (int)((int64)x * src.cols / gray.cols);
+    }
+    
+    virtual void operator()(const Range &range) const{
+        for (int y = range.start; y < range.end; y++) {
+            int y0 = (int)((int64)y * src.rows / gray.rows);
+            int y1 = (int)((int64)(y + 1) * src.rows / gray.rows);
+            uchar *out = gray.ptr<uchar>(y);
+            
+            for (int x = 0; x < gray.cols; x++) {
+                int x0 = xofs[x], x1 = xofs[x + 1];
+                int sb = 0, sg = 0, sr = 0;
+                
+                for (int sy = y0; sy < y1; sy++) {
+                    const uchar *p = src.ptr<uchar>(sy) + x0*3;
+                    for (int sx = x0; sx < x1; sx++, p += 3) {
+                        sb += p[0];
+                        sg += p[1];
+                        sr += p[2];
+                    }
+                }
+                
+                int64 count = (int64)(x1 - x0) * (y1 - y0);
+                int64 luma = (int64)sb*LUMA_B + (int64)sg*LUMA_G + (int64)sr*LUMA_R;
+                out[x] = (uchar)((luma + (count << (LUMA_BITS - 1))) / (count << LUMA_BITS));
+            }
+        }
+    }
+    
+private:
+    const Mat &src;
+    Mat &gray;
+    vector<int> xofs;
+};
+
+/* ----------------------------------------
+grayscale copy of a BGR or gray image at the
+given size. Downscaling a BGR image averages
+and converts in a single pass over the source.
+-------------------------------------------*/
+void resizeToGray(const Mat &src, Mat &gray, Size size){
+    if (src.channels() == 1) {
+        if (src.size() == size)
+            gray = src;
+        else
+            resize(src, gray, size, 0, 0, INTER_AREA);
+        return;
+    }
+    
+    if (src.size() == size) {
+        cvtColor(src, gray, CV_BGR2GRAY);
+        return;
+    }
+    
+    if (size.width > src.cols || size.height > src.rows || src.depth() != CV_8U || src.channels() != 3) {
+        Mat temp;
+        cvtColor(src, temp, CV_BGR2GRAY);
+        resize(temp, gray, size);
+        return;
+    }
+    
+    gray.create(size, CV_8UC1);
+    parallelFor(Range(0, size.height), BoxGray(src, gray));
+}
+
+/* ----------------------------------------
+takes a decoded frame to the processing size
+(frame) and to the grayscale detection image
+(gray). The decoded frame is used in place
+when no resize is needed, otherwise the
+buffers of the previous call are reused.
+-------------------------------------------*/
+void ingestFrame(const Mat &src, Size procSize, Size detectSize, Mat &frame, Mat &gray){
+    if (src.size() == procSize)
+        frame = src;
+    else
+        resize(src, frame, procSize);
+    
+    resizeToGray(src, gray, detectSize);
+}
+
+//luma and chroma planes of an I420 frame stored as a single channel image 3/2 its height, chroma rows are half the luma stride
+void splitI420(const Mat &yuv, Mat &y, Mat &u, Mat &v){
+    int rows = yuv.rows*2/3, cols = yuv.cols;
+    size_t step = yuv.step/2;
+    uchar *planes = (uchar *)yuv.ptr<uchar>(rows);
+    
+    y = yuv.rowRange(0, rows);
+    u = Mat(rows/2, cols/2, CV_8UC1, planes, step);
+    v = Mat(rows/2, cols/2, CV_8UC1, planes + (rows/2)*step, step);
+}
+
+/* ----------------------------------------
+same as ingestFrame for planar YUV 4:2:0
+frames. The detection image comes straight
+from the luma plane, no colour conversion.
+-------------------------------------------*/
+void ingestI420(const Mat &src, Size procSize, Size detectSize, Mat &frame, Mat &gray){
+    Mat y, u, v;
+    splitI420(src, y, u, v);
+    
+    if (y.size() == procSize)
+        frame = src;
+    else {
+        frame.create(procSize.height*3/2, procSize.width, CV_8UC1);
+        
+        Mat fy, fu, fv;
+        splitI420(frame, fy, fu, fv);
+        resize(y, fy, fy.size());
+        resize(u, fu, fu.size());
+        resize(v, fv, fv.size());
+    }
+    
+    resizeToGray(y, gray, detectSize);
+}
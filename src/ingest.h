@@ -0,0 +1,24 @@
+//  Plane Projection
+//  ingest.h
+//
+//  University of Bristol
+//
+//  Created by Henrique Grandinetti on 13/07/15.
+//  henriquegrandinetti@gmail.com
+
+#ifndef __ACCTVP__ingest__
+#define __ACCTVP__ingest__
+
+#include <stdio.h>
+
+#include "opencv2/core/core.hpp"
+
+using namespace cv;
+using namespace std;
+
+void ingestFrame(const Mat &src, Size procSize, Size detectSize, Mat &frame, Mat &gray);
+void ingestI420(const Mat &src, Size procSize, Size detectSize, Mat &frame, Mat &gray);
+void resizeToGray(const Mat &src, Mat &gray, Size size);
+void splitI420(const Mat &yuv, Mat &y, Mat &u, Mat &v);
+
+#endif
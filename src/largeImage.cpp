@@ -0,0 +1,337 @@
+//  Plane Projection
+//  largeImage.cpp
+//
+//  University of Bristol
+//
+//  Created by Henrique Grandinetti on 13/07/15.
+//  henriquegrandinetti@gmail.com
+
+#include "largeImage.h"
+
+#include "opencv2/imgproc/imgproc.hpp"
+
+#include <ctype.h>
+#include <stdlib.h>
+
+#ifndef WIN32
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+MappedImage::MappedImage(){
+    data = 0;
+    length = 0;
+    offset = 0;
+    rows = cols = channels = 0;
+}
+
+MappedImage::~MappedImage(){
+    release();
+}
+
+//next header number, skipping white space and comments
+static bool headerNumber(const uchar *data, size_t length, size_t &pos, int &value){
+    while (pos < length && (isspace(data[pos]) || data[pos] == '#')) {
+        if (data[pos] == '#')
+            while (pos < length && data[pos] != '\n')
+                pos++;
+        else
+            pos++;
+    }
+
+    if (pos >= length || !isdigit(data[pos]))
+        return false;
+
+    value = 0;
+    while (pos < length && isdigit(data[pos]))
+        value = value*10 + (data[pos++] - '0');
+
+    return true;
+}
+
+bool MappedImage::open(const string &fileName){
+    release();
+
+#ifdef WIN32
+    printf("ERROR: large image input needs a POSIX system\n");
+    return false;
+#else
+    int fd = ::open(fileName.c_str(), O_RDONLY);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) != 0 || st.st_size < 2) {
+        if (fd >= 0)
+            close(fd);
+        printf("ERROR: can not open %s\n", fileName.c_str());
+        return false;
+    }
+
+    void *p = mmap(0, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+
+    if (p == MAP_FAILED) {
+        printf("ERROR: can not map %s\n", fileName.c_str());
+        return false;
+    }
+
+    data = (uchar *)p;
+    length = (size_t)st.st_size;
+#endif
+
+    if (data[0] != 'P' || (data[1] != '5' && data[1] != '6')) {
+        printf("ERROR: %s is not a binary PGM or PPM image\n", fileName.c_str());
+        release();
+        return false;
+    }
+
+    channels = data[1] == '6' ? 3 : 1;
+
+    size_t pos = 2;
+    int maxval = 0;
+    if (!headerNumber(data, length, pos, cols) || !headerNumber(data, length, pos, rows) || !headerNumber(data, length, pos, maxval)
+        || maxval > 255 || pos >= length || (size_t)rows*cols*channels > length - pos - 1) {
+        printf("ERROR: %s has an unsupported or truncated header\n", fileName.c_str());
+        release();
+        return false;
+    }
+
+    //a single white space character precedes the pixels
+    offset = pos + 1;
+
+#ifndef WIN32
+    madvise(data, length, MADV_SEQUENTIAL);
+#endif
+    return true;
+}
+
+void MappedImage::release(){
+#ifndef WIN32
+    if (data)
+        munmap(data, length);
+#endif
+    data = 0;
+    length = 0;
+}
+
+//whole image as a header, PPM images are in RGB order
+Mat MappedImage::image(){
+    return Mat(rows, cols, CV_8UC(channels), data + offset, (size_t)cols*channels);
+}
+
+//gives the pages of rows [y0, y1) back, they are read again from the file if needed
+void MappedImage::dropRows(int y0, int y1){
+#ifndef WIN32
+    size_t page = (size_t)sysconf(_SC_PAGESIZE);
+    size_t start = (offset + (size_t)y0*cols*channels) & ~(page - 1);
+    size_t end = std::min(length, offset + (size_t)y1*cols*channels);
+
+    if (end > start)
+        madvise(data + start, end - start, MADV_DONTNEED);
+#endif
+}
+
+/* ----------------------------------------
+region box filtered by scale x scale blocks,
+read from the mapping one block row at a time
+and its pages handed back after each, so only
+the result and one block row are held. The
+scale is halved for regions thinner than it,
+the one used is returned.
+-------------------------------------------*/
+int MappedImage::decimate(Rect region, int scale, Mat &dst){
+    while (scale > 1 && (region.width < scale || region.height < scale))
+        scale /= 2;
+
+    int w = region.width/scale, h = region.height/scale;
+    int cn = channels, area = scale*scale;
+    dst.create(h, w, CV_8UC(cn));
+
+    vector<int64> sums((size_t)w*cn);
+    for (int y = 0; y < h; y++) {
+        std::fill(sums.begin(), sums.end(), 0);
+
+        for (int r = 0; r < scale; r++) {
+            const uchar *row = data + offset + ((size_t)(region.y + y*scale + r)*cols + region.x)*cn;
+            for (int x = 0; x < w; x++) {
+                int64 *sum = &sums[(size_t)x*cn];
+                for (int k = 0; k < scale*cn; k += cn, row += cn)
+                    for (int c = 0; c < cn; c++)
+                        sum[c] += row[c];
+            }
+        }
+
+        uchar *out = dst.ptr<uchar>(y);
+        for (size_t i = 0; i < sums.size(); i++)
+            out[i] = (uchar)((sums[i] + area/2)/area);
+
+        dropRows(region.y + y*scale, region.y + (y + 1)*scale);
+    }
+
+    return scale;
+}
+
+//bytes held while a region is read at 1/scale: the result, the pages of one block row and the block sums
+static size_t levelBytes(Rect region, int scale, int cols, int channels){
+    size_t rowBytes = std::min((size_t)cols*channels, (size_t)region.width*channels + 4096);
+    if (scale == 1)
+        return (size_t)region.height*rowBytes;
+
+    size_t w = region.width/scale + 1, h = region.height/scale + 1;
+    return w*h*channels + (size_t)scale*rowBytes + w*channels*sizeof(int64);
+}
+
+/* ----------------------------------------
+renders a tile of the top-view into the band
+it belongs to. Tiles that need more source
+pixels than the budget allows are split, down
+to LARGE_MIN_TILE. The source region is then
+read at a coarser level than the tile needs
+until it fits, false if no level does.
+-------------------------------------------*/
+static bool renderTile(TopView &tv, MappedImage &mapped, Rect tile, Mat &band, int bandY, size_t budget){
+    Rect region = tv.tileSourceRegion(tile);
+    if (region.area() == 0)
+        return true;
+
+    Mat img = mapped.image();
+    int level = tv.tileLevel(tile);
+
+    if (levelBytes(region, 1 << level, img.cols, img.channels()) > budget && std::max(tile.width, tile.height) > LARGE_MIN_TILE) {
+        int w = tile.width/2, h = tile.height/2;
+        if (tile.width >= tile.height)
+            return renderTile(tv, mapped, Rect(tile.x, tile.y, w, tile.height), band, bandY, budget)
+                && renderTile(tv, mapped, Rect(tile.x + w, tile.y, tile.width - w, tile.height), band, bandY, budget);
+
+        return renderTile(tv, mapped, Rect(tile.x, tile.y, tile.width, h), band, bandY, budget)
+            && renderTile(tv, mapped, Rect(tile.x, tile.y + h, tile.width, tile.height - h), band, bandY, budget);
+    }
+
+    while (level < LARGE_MAX_LEVEL && levelBytes(region, 1 << level, img.cols, img.channels()) > budget)
+        level++;
+
+    size_t bytes = levelBytes(region, 1 << level, img.cols, img.channels());
+    if (bytes > budget) {
+        printf("ERROR: the %d x %d tile at (%d, %d) needs %.1f MB of source even at 1/%d, over the %.1f MB budget\n",
+               tile.width, tile.height, tile.x, tile.y, bytes/1048576.0, 1 << level, budget/1048576.0);
+        return false;
+    }
+
+    Mat dst;
+    if (level == 0) {
+        tv.warpTileLevel(img(region), 1, region.tl(), tile, dst);
+        mapped.dropRows(region.y, region.y + region.height);
+    }
+    else {
+        Mat source;
+        int scale = mapped.decimate(region, 1 << level, source);
+        tv.warpTileLevel(source, scale, region.tl(), tile, dst);
+    }
+
+    Mat roi = band(Rect(tile.x, tile.y - bandY, tile.width, tile.height));
+    dst.copyTo(roi);
+    return true;
+}
+
+/* ----------------------------------------
+calibrates and warps a binary PGM/PPM image of
+any size holding at most about memoryBudget
+bytes of image data: lines are found on a box
+filtered overview, the top-view is warped tile
+by tile from the source regions each tile sees
+and written to a PGM/PPM file band by band.
+-------------------------------------------*/
+int runLargeImage(const string &input, const string &output, detectionParams detection, const largeImageOptions &options){
+    MappedImage mapped;
+    if (!mapped.open(input))
+        return -1;
+
+    Mat img = mapped.image();
+    size_t rowBytes = (size_t)img.cols*img.channels();
+    printf("Input image: (%d x %d), %d channels\n", img.cols, img.rows, img.channels());
+
+    //overview, built band by band with an integer box filter
+    int overviewWidth = options.overviewWidth > 0 ? options.overviewWidth : LARGE_OVERVIEW_WIDTH;
+    int d = std::max(1, (std::max(img.cols, img.rows) + overviewWidth - 1)/overviewWidth);
+    Mat overview(img.rows/d, img.cols/d, CV_8UC1);
+
+    int bandRows = std::max(1, (int)(options.memoryBudget/4/((size_t)d*rowBytes)));
+    for (int y = 0; y < overview.rows; y += bandRows) {
+        int n = std::min(bandRows, overview.rows - y);
+        Mat band = img(Rect(0, y*d, overview.cols*d, n*d));
+
+        Mat small, dst = overview.rowRange(y, y + n);
+        resize(band, small, Size(overview.cols, n), 0, 0, INTER_AREA);
+        if (small.channels() == 3)
+            cvtColor(small, dst, CV_RGB2GRAY);
+        else
+            small.copyTo(dst);
+
+        mapped.dropRows(y*d, (y + n)*d);
+    }
+
+    printf("Detect at: (%d x %d)\n", overview.cols, overview.rows);
+
+    //vanishing points in full image coordinates
+    detection.scale = (float)d;
+    detection.distCoeffs = Mat();
+
+    MSAC msac;
+    msac.init(img.size());
+    Mat none;
+    Vec4f vp = automaticCalibration(msac, detection, overview, none);
+
+    if (!validVPS(vp)) {
+        printf("ERROR: no vanishing points found\n");
+        return -1;
+    }
+
+    mouseDataCrop crop;
+    crop.ground = options.crop;
+    TopView tv(img, Point2f(vp[0], vp[1]), Point2f(vp[2], vp[3]), &crop);
+    if (options.topSize.width > 0 && options.topSize.height > 0)
+        tv.setOutputSize(options.topSize);
+    if (options.gsd > 0)
+        tv.setGroundSampling(options.gsd);
+    tv.computeTransformation();
+
+    Size top = tv.getTopSize();
+    printf("Top view: (%d x %d)\n", top.width, top.height);
+
+    //a quarter of the budget for the output band, half for source regions
+    int tileRows = (int)std::min((size_t)LARGE_TILE_SIZE, options.memoryBudget/4/((size_t)top.width*img.channels()));
+    if (tileRows < 1) {
+        printf("ERROR: memory budget too small for a %d pixels wide top view\n", top.width);
+        return -1;
+    }
+
+    FILE *file = fopen(output.c_str(), "wb");
+    if (!file) {
+        printf("ERROR: can not create %s\n", output.c_str());
+        return -1;
+    }
+    fprintf(file, "P%d\n%d %d\n255\n", img.channels() == 3 ? 6 : 5, top.width, top.height);
+
+    int64 start = getTickCount();
+
+    Mat band;
+    for (int y = 0; y < top.height; y += tileRows) {
+        int n = std::min(tileRows, top.height - y);
+        band = Mat::zeros(n, top.width, img.type());
+
+        for (int x = 0; x < top.width; x += LARGE_TILE_SIZE) {
+            if (!renderTile(tv, mapped, Rect(x, y, std::min(LARGE_TILE_SIZE, top.width - x), n), band, y, options.memoryBudget/2)) {
+                fclose(file);
+                remove(output.c_str());
+                return -1;
+            }
+        }
+
+        fwrite(band.data, 1, band.total()*band.elemSize(), file);
+    }
+
+    fclose(file);
+
+    printf("Top view written in %.2f s\n", (getTickCount() - start)/getTickFrequency());
+    return 0;
+}
@@ -0,0 +1,62 @@
+//  Plane Projection
+//  largeImage.h
+//
+//  University of Bristol
+//
+//  Created by Henrique Grandinetti on 13/07/15.
+//  henriquegrandinetti@gmail.com
+
+#ifndef __ACCTVP__largeImage__
+#define __ACCTVP__largeImage__
+
+#include <stdio.h>
+
+#include "opencv2/core/core.hpp"
+
+#include "MSAC.h"
+#include "TopView.h"
+#include "vanishingPoint.h"
+
+using namespace cv;
+using namespace std;
+
+#define LARGE_OVERVIEW_WIDTH    1024    //longest side of the detection overview
+#define LARGE_TILE_SIZE         512     //top-view tile side
+#define LARGE_MIN_TILE          32      //tiles are not split below this side
+#define LARGE_MAX_LEVEL         10      //coarsest level a source region may be read at to fit the budget
+
+/* ----------------------------------------
+binary PGM (P5) or PPM (P6) image mapped
+from its file, regions are Mat headers into
+the mapping and are read only when touched.
+-------------------------------------------*/
+class MappedImage{
+public:
+    MappedImage();
+    ~MappedImage();
+
+    bool open(const string &fileName);
+    void release();
+
+    Mat image();
+    void dropRows(int y0, int y1);
+    int decimate(Rect region, int scale, Mat &dst);
+
+private:
+    uchar *data;
+    size_t length;
+    size_t offset;  //first pixel byte
+    int rows, cols, channels;
+};
+
+typedef struct largeImageOptions{
+    size_t memoryBudget;    //bytes held by image data at any time
+    int overviewWidth;      //detection overview longest side, -1 for LARGE_OVERVIEW_WIDTH
+    Size topSize;           //(-1, -1) for the input size
+    float gsd;              //overrides topSize
+    Rect_<float> crop;      //ground region of the top-view, empty for none
+}largeImageOptions;
+
+int runLargeImage(const string &input, const string &output, detectionParams detection, const largeImageOptions &options);
+
+#endif
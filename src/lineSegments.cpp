@@ -0,0 +1,452 @@
+//  Plane Projection
+//  lineSegments.cpp
+//
+//  University of Bristol
+//
+//  Created by Henrique Grandinetti on 13/07/15.
+//  henriquegrandinetti@gmail.com
+
+#include "lineSegments.h"
+
+#include "opencv2/imgproc/imgproc.hpp"
+
+#include <algorithm>
+#include <functional>
+#include <float.h>
+
+#define EDGEL_BINS          16      //orientation bins over 180 degrees
+#define EDGEL_MIN_GRADIENT  120     //L1 gradient magnitude, same scale as the Canny thresholds
+#define EDGEL_MIN_PIXELS    20      //smallest line-support region
+#define EDGEL_MAX_WIDTH     1.5     //standard deviation across a line-support region
+
+#define MERGE_BINS          90      //orientation bins over 180 degrees
+#define MERGE_ANGLE         2.0     //degrees between segments of one line
+#define MERGE_DISTANCE      2.0     //largest distance from the end-points of a segment to the line of another
+#define MERGE_GAP           20.0    //largest gap between collinear segments that are joined
+
+//Originally written by Marcos Nieto
+//sizeThreshold lowers the threshold for small images, off when the caller already chose it for the whole image
+void houghSegments(Mat &imgGRAY, int houghThreshold, vector<vector<Point> > &lineSegments, bool sizeThreshold){
+    Mat imgCanny;
+
+    // Canny
+    Canny(imgGRAY, imgCanny, 200, 120, 3);
+
+    // Hough
+    vector<Vec4i> lines;
+    if(sizeThreshold && imgGRAY.cols*imgGRAY.rows < 400*400)
+        houghThreshold = houghThreshold * (float)2/3;
+
+    HoughLinesP(imgCanny, lines, 1, CV_PI/180, houghThreshold, 80, 60);
+
+    while(lines.size() > MAX_NUM_LINES)
+    {
+        lines.clear();
+        houghThreshold += 10;
+        HoughLinesP(imgCanny, lines, 1, CV_PI/180, houghThreshold, 10, 10);
+    }
+
+    // Store into vector of pairs of Points for msac
+    vector<Point> aux;
+    for(size_t i=0; i<lines.size(); i++){
+        aux.clear();
+        aux.push_back(Point(lines[i][0], lines[i][1]));
+        aux.push_back(Point(lines[i][2], lines[i][3]));
+        lineSegments.push_back(aux);
+    }
+}
+
+/* ----------------------------------------
+groups strong edgels with the same gradient
+orientation into line-support regions and
+fits one segment to each region.
+-------------------------------------------*/
+void edgelSegments(Mat &imgGRAY, vector<vector<Point> > &lineSegments){
+    int rows = imgGRAY.rows;
+    int cols = imgGRAY.cols;
+
+    Mat gx, gy;
+    Sobel(imgGRAY, gx, CV_16S, 1, 0, 3);
+    Sobel(imgGRAY, gy, CV_16S, 0, 1, 3);
+
+    //orientation bin (1..EDGEL_BINS) of every strong edgel, 0 for weak or used pixels
+    Mat bins = Mat::zeros(rows, cols, CV_8U);
+    float binWidth = 180.0f/EDGEL_BINS;
+
+    for (int y = 1; y < rows - 1; y++) {
+        const short *pgx = gx.ptr<short>(y);
+        const short *pgy = gy.ptr<short>(y);
+        uchar *pb = bins.ptr<uchar>(y);
+
+        for (int x = 1; x < cols - 1; x++) {
+            if (abs(pgx[x]) + abs(pgy[x]) < EDGEL_MIN_GRADIENT)
+                continue;
+
+            float angle = fastAtan2(pgy[x], pgx[x]);
+            if (angle >= 180)
+                angle -= 180;
+
+            pb[x] = (uchar)(std::min((int)(angle/binWidth), EDGEL_BINS - 1) + 1);
+        }
+    }
+
+    int minLength = std::max(20, (int)(sqrt((double)rows*rows + (double)cols*cols)/40));
+
+    vector<Point> region;
+    vector<vector<Point> > segments;
+    vector<pair<float, int> > lengths;
+
+    for (int y = 1; y < rows - 1; y++) {
+        uchar *pb = bins.ptr<uchar>(y);
+
+        for (int x = 1; x < cols - 1; x++) {
+            int seed = pb[x];
+            if (!seed)
+                continue;
+
+            //grow the region over 8-neighbours within one bin of the seed orientation
+            region.clear();
+            region.push_back(Point(x, y));
+            pb[x] = 0;
+
+            double sx = 0, sy = 0, sxx = 0, syy = 0, sxy = 0;
+
+            for (size_t k = 0; k < region.size(); k++) {
+                Point p = region[k];
+                sx += p.x; sy += p.y;
+                sxx += (double)p.x * p.x; syy += (double)p.y * p.y; sxy += (double)p.x * p.y;
+
+                for (int dy = -1; dy <= 1; dy++) {
+                    uchar *nb = bins.ptr<uchar>(p.y + dy);
+                    for (int dx = -1; dx <= 1; dx++) {
+                        int bin = nb[p.x + dx];
+                        if (!bin)
+                            continue;
+                        int d = abs(bin - seed);
+                        if (d <= 1 || d == EDGEL_BINS - 1) {
+                            nb[p.x + dx] = 0;
+                            region.push_back(Point(p.x + dx, p.y + dy));
+                        }
+                    }
+                }
+            }
+
+            int n = (int)region.size();
+            if (n < EDGEL_MIN_PIXELS)
+                continue;
+
+            //principal axis of the region
+            double mx = sx/n, my = sy/n;
+            double cxx = sxx/n - mx*mx;
+            double cyy = syy/n - my*my;
+            double cxy = sxy/n - mx*my;
+
+            double minor = 0.5*(cxx + cyy - sqrt((cxx - cyy)*(cxx - cyy) + 4*cxy*cxy));
+            if (minor > EDGEL_MAX_WIDTH*EDGEL_MAX_WIDTH)
+                continue;
+
+            double theta = 0.5*atan2(2*cxy, cxx - cyy);
+            double dirx = cos(theta), diry = sin(theta);
+
+            double tmin = DBL_MAX, tmax = -DBL_MAX;
+            for (int k = 0; k < n; k++) {
+                double t = (region[k].x - mx)*dirx + (region[k].y - my)*diry;
+                tmin = std::min(tmin, t);
+                tmax = std::max(tmax, t);
+            }
+
+            if (tmax - tmin < minLength)
+                continue;
+
+            vector<Point> aux;
+            aux.push_back(Point(cvRound(mx + dirx*tmin), cvRound(my + diry*tmin)));
+            aux.push_back(Point(cvRound(mx + dirx*tmax), cvRound(my + diry*tmax)));
+
+            lengths.push_back(make_pair((float)(tmax - tmin), (int)segments.size()));
+            segments.push_back(aux);
+        }
+    }
+
+    //keep the longest segments only, as the Hough path does
+    size_t numLines = std::min(segments.size(), (size_t)MAX_NUM_LINES);
+    std::partial_sort(lengths.begin(), lengths.begin() + numLines, lengths.end(), std::greater<pair<float, int> >());
+
+    for (size_t i = 0; i < numLines; i++)
+        lineSegments.push_back(segments[lengths[i].second]);
+}
+
+//clips the segment a-b to the pixels of the tile, false if it misses it
+static bool clipSegment(Point2f &a, Point2f &b, Rect tile){
+    float t0 = 0, t1 = 1;
+    Point2f d = b - a;
+    float p[4] = {-d.x, d.x, -d.y, d.y};
+    float q[4] = {a.x - tile.x, tile.x + tile.width - 1 - a.x, a.y - tile.y, tile.y + tile.height - 1 - a.y};
+
+    //Liang-Barsky
+    for (int k = 0; k < 4; k++) {
+        if (p[k] == 0) {
+            if (q[k] < 0)
+                return false;
+            continue;
+        }
+
+        float t = q[k]/p[k];
+        if (p[k] < 0)
+            t0 = std::max(t0, t);
+        else
+            t1 = std::min(t1, t);
+    }
+
+    if (t0 >= t1)
+        return false;
+
+    Point2f c = a;
+    a = c + d*t0;
+    b = c + d*t1;
+    return true;
+}
+
+/* ----------------------------------------
+line segments of a still camera tile by tile:
+a tile that differs from the image it was last
+detected on by more than threshold (mean
+absolute difference) is detected again with a
+margin around it, the others keep their
+segments. A segment is clipped to each tile
+it is found in, so a line crossing a border is
+counted once, in pieces the merge can join.
+-------------------------------------------*/
+void tiledSegments(Mat &imgGRAY, bool edgel, int houghThreshold, float threshold, segmentCache &cache, vector<vector<Point> > &lineSegments){
+    int nx = (imgGRAY.cols + SEGMENT_TILE_SIZE - 1)/SEGMENT_TILE_SIZE;
+    int ny = (imgGRAY.rows + SEGMENT_TILE_SIZE - 1)/SEGMENT_TILE_SIZE;
+    Rect image(0, 0, imgGRAY.cols, imgGRAY.rows);
+
+    //new image size, every tile is detected
+    bool all = cache.reference.size() != imgGRAY.size();
+    if (all) {
+        cache.reference.create(imgGRAY.size(), CV_8UC1);
+        cache.tiles.assign(nx*ny, vector<vector<Point> >());
+    }
+
+    cache.numTiles = nx*ny;
+    cache.dirtyTiles = 0;
+
+    //threshold of the whole image, a tile alone would take the small image one
+    if (!edgel && imgGRAY.cols*imgGRAY.rows < 400*400)
+        houghThreshold = houghThreshold * (float)2/3;
+
+    for (int ty = 0; ty < ny; ty++) {
+        for (int tx = 0; tx < nx; tx++) {
+            Rect tile = Rect(tx*SEGMENT_TILE_SIZE, ty*SEGMENT_TILE_SIZE, SEGMENT_TILE_SIZE, SEGMENT_TILE_SIZE) & image;
+
+            //compared with its own reference, slow changes add up until the tile is detected again
+            if (!all && norm(imgGRAY(tile), cache.reference(tile), NORM_L1) <= threshold*tile.area())
+                continue;
+
+            //the margin gives lines crossing the tile border enough support
+            Rect region = Rect(tile.x - SEGMENT_TILE_MARGIN, tile.y - SEGMENT_TILE_MARGIN,
+                               tile.width + 2*SEGMENT_TILE_MARGIN, tile.height + 2*SEGMENT_TILE_MARGIN) & image;
+            Mat roi = imgGRAY(region);
+
+            vector<vector<Point> > found;
+            if (edgel)
+                edgelSegments(roi, found);
+            else
+                houghSegments(roi, houghThreshold, found, false);
+
+            vector<vector<Point> > &segments = cache.tiles[ty*nx + tx];
+            segments.clear();
+
+            for (size_t i = 0; i < found.size(); i++) {
+                Point2f a = found[i][0] + region.tl();
+                Point2f b = found[i][1] + region.tl();
+                if (!clipSegment(a, b, tile))
+                    continue;
+
+                vector<Point> aux;
+                aux.push_back(Point(cvRound(a.x), cvRound(a.y)));
+                aux.push_back(Point(cvRound(b.x), cvRound(b.y)));
+                if (aux[0] != aux[1])
+                    segments.push_back(aux);
+            }
+
+            Mat dst = cache.reference(tile);
+            imgGRAY(tile).copyTo(dst);
+            cache.dirtyTiles++;
+        }
+    }
+
+    //keep the longest segments only, as the whole image detectors do
+    vector<pair<float, pair<int, int> > > lengths;
+    for (size_t t = 0; t < cache.tiles.size(); t++) {
+        for (size_t i = 0; i < cache.tiles[t].size(); i++) {
+            Point d = cache.tiles[t][i][1] - cache.tiles[t][i][0];
+            lengths.push_back(make_pair((float)(d.x*d.x + d.y*d.y), make_pair((int)t, (int)i)));
+        }
+    }
+
+    size_t numLines = std::min(lengths.size(), (size_t)MAX_NUM_LINES);
+    std::partial_sort(lengths.begin(), lengths.begin() + numLines, lengths.end(), std::greater<pair<float, pair<int, int> > >());
+
+    for (size_t i = 0; i < numLines; i++)
+        lineSegments.push_back(cache.tiles[lengths[i].second.first][lengths[i].second.second]);
+}
+
+/* ----------------------------------------
+merges the segments of one line, fragments and
+near duplicates, into a single segment that
+spans them. Segments are taken longest first
+and compared only with the ones in neighbouring
+orientation bins. MSAC weighs a segment by its
+length, so the merged segment is as long as the
+union of what was found, centred on the line:
+an edge found twice does not weigh twice and
+the gaps of a dashed edge add no weight.
+-------------------------------------------*/
+void mergeCollinearSegments(vector<vector<Point> > &lineSegments){
+    size_t n = lineSegments.size();
+    if (n < 2)
+        return;
+
+    vector<Point2f> dirs(n);
+    vector<float> lengths(n);
+    vector<int> bins(n);
+    vector<vector<int> > binned(MERGE_BINS);
+    vector<pair<float, int> > order(n);
+
+    for (size_t i = 0; i < n; i++) {
+        Point2f d = Point2f(lineSegments[i][1] - lineSegments[i][0]);
+        float length = (float)norm(d);
+
+        dirs[i] = length > 0 ? d*(1/length) : Point2f(1, 0);
+        lengths[i] = length;
+
+        float angle = fastAtan2(dirs[i].y, dirs[i].x);
+        if (angle >= 180)
+            angle -= 180;
+
+        bins[i] = std::min((int)(angle*MERGE_BINS/180), MERGE_BINS - 1);
+        binned[bins[i]].push_back((int)i);
+        order[i] = make_pair(length, (int)i);
+    }
+
+    std::sort(order.begin(), order.end(), std::greater<pair<float, int> >());
+
+    float minCos = (float)cos(MERGE_ANGLE*CV_PI/180);
+    int reach = cvCeil(MERGE_ANGLE*MERGE_BINS/180);
+
+    vector<bool> used(n, false);
+    vector<vector<Point> > merged;
+
+    for (size_t k = 0; k < n; k++) {
+        int i = order[k].second;
+        if (used[i])
+            continue;
+        used[i] = true;
+
+        //extent along the segment and length weighted offset across it
+        Point2f p0 = lineSegments[i][0];
+        Point2f d = dirs[i];
+        Point2f normal(-d.y, d.x);
+        float t0 = 0, t1 = lengths[i];
+        double offset = 0, weight = lengths[i];
+        vector<pair<float, float> > covered(1, make_pair(0.0f, lengths[i]));
+
+        //joined segments extend the line, others may now be close enough
+        for (bool grown = true; grown;) {
+            grown = false;
+
+            for (int b = -reach; b <= reach; b++) {
+                const vector<int> &candidates = binned[(bins[i] + b + MERGE_BINS) % MERGE_BINS];
+
+                for (size_t c = 0; c < candidates.size(); c++) {
+                    int j = candidates[c];
+                    if (used[j] || fabs(dirs[j].dot(d)) < minCos)
+                        continue;
+
+                    Point2f a = Point2f(lineSegments[j][0]) - p0;
+                    Point2f e = Point2f(lineSegments[j][1]) - p0;
+                    float da = a.dot(normal), de = e.dot(normal);
+                    if (fabs(da) > MERGE_DISTANCE || fabs(de) > MERGE_DISTANCE)
+                        continue;
+
+                    float ta = a.dot(d), te = e.dot(d);
+                    if (std::min(ta, te) > t1 + MERGE_GAP || std::max(ta, te) < t0 - MERGE_GAP)
+                        continue;
+
+                    t0 = std::min(t0, std::min(ta, te));
+                    t1 = std::max(t1, std::max(ta, te));
+                    offset += lengths[j]*(da + de)/2;
+                    weight += lengths[j];
+                    covered.push_back(make_pair(std::min(ta, te), std::max(ta, te)));
+
+                    used[j] = true;
+                    grown = true;
+                }
+            }
+        }
+
+        //union of the covered intervals
+        std::sort(covered.begin(), covered.end());
+        float length = 0, end = covered[0].first;
+        for (size_t c = 0; c < covered.size(); c++) {
+            length += std::max(0.0f, covered[c].second - std::max(end, covered[c].first));
+            end = std::max(end, covered[c].second);
+        }
+
+        Point2f shift = normal*(float)(offset/weight);
+        Point2f middle = p0 + d*((t0 + t1)/2) + shift;
+        Point2f a = middle - d*(length/2);
+        Point2f e = middle + d*(length/2);
+
+        vector<Point> aux;
+        aux.push_back(Point(cvRound(a.x), cvRound(a.y)));
+        aux.push_back(Point(cvRound(e.x), cvRound(e.y)));
+        merged.push_back(aux);
+    }
+
+    lineSegments.swap(merged);
+}
+
+//scales the end-points of line segments, e.g. from a downscaled detection image to the frame
+void scaleSegments(vector<vector<Point> > &lineSegments, float scale){
+    for (size_t i = 0; i < lineSegments.size(); i++) {
+        for (size_t j = 0; j < lineSegments[i].size(); j++)
+            lineSegments[i][j] = Point(cvRound(lineSegments[i][j].x * scale), cvRound(lineSegments[i][j].y * scale));
+    }
+}
+
+//moves the end-points of line segments to undistorted image coordinates
+void undistortSegments(vector<vector<Point> > &lineSegments, const Mat &cameraMatrix, const Mat &distCoeffs){
+    if (lineSegments.empty())
+        return;
+    
+    vector<Point2f> points, undistorted;
+    for (size_t i = 0; i < lineSegments.size(); i++) {
+        points.push_back(lineSegments[i][0]);
+        points.push_back(lineSegments[i][1]);
+    }
+    
+    undistortPoints(points, undistorted, cameraMatrix, distCoeffs, noArray(), cameraMatrix);
+    
+    for (size_t i = 0; i < lineSegments.size(); i++) {
+        lineSegments[i][0] = Point(cvRound(undistorted[2*i].x), cvRound(undistorted[2*i].y));
+        lineSegments[i][1] = Point(cvRound(undistorted[2*i + 1].x), cvRound(undistorted[2*i + 1].y));
+    }
+}
+
+void undistortSegments(vector<Vec4f> &lineSegments, const Mat &cameraMatrix, const Mat &distCoeffs){
+    if (lineSegments.empty())
+        return;
+    
+    vector<Point2f> points, undistorted;
+    for (size_t i = 0; i < lineSegments.size(); i++) {
+        points.push_back(Point2f(lineSegments[i][0], lineSegments[i][1]));
+        points.push_back(Point2f(lineSegments[i][2], lineSegments[i][3]));
+    }
+    
+    undistortPoints(points, undistorted, cameraMatrix, distCoeffs, noArray(), cameraMatrix);
+    
+    for (size_t i = 0; i < lineSegments.size(); i++)
+        lineSegments[i] = Vec4f(undistorted[2*i].x, undistorted[2*i].y, undistorted[2*i + 1].x, undistorted[2*i + 1].y);
+}
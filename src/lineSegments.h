@@ -0,0 +1,40 @@
+//  Plane Projection
+//  lineSegments.h
+//
+//  University of Bristol
+//
+//  Created by Henrique Grandinetti on 13/07/15.
+//  henriquegrandinetti@gmail.com
+
+#ifndef __ACCTVP__lineSegments__
+#define __ACCTVP__lineSegments__
+
+#include <stdio.h>
+
+#include "opencv2/core/core.hpp"
+
+using namespace cv;
+using namespace std;
+
+#define MAX_NUM_LINES	200
+
+#define SEGMENT_TILE_SIZE   128     //side of the tiles detected again when they change
+#define SEGMENT_TILE_MARGIN 32      //pixels around a tile its detection also sees
+
+//segments of the detection image kept tile by tile across frames of a still camera
+typedef struct segmentCache{
+    Mat reference;                              //image each tile was last detected on
+    vector<vector<vector<Point> > > tiles;      //segments found around the tile, clipped to it
+    int numTiles;
+    int dirtyTiles;                             //tiles detected again on the last image
+}segmentCache;
+
+void houghSegments(Mat &imgGRAY, int houghThreshold, vector<vector<Point> > &lineSegments, bool sizeThreshold = true);
+void edgelSegments(Mat &imgGRAY, vector<vector<Point> > &lineSegments);
+void tiledSegments(Mat &imgGRAY, bool edgel, int houghThreshold, float threshold, segmentCache &cache, vector<vector<Point> > &lineSegments);
+void mergeCollinearSegments(vector<vector<Point> > &lineSegments);
+void scaleSegments(vector<vector<Point> > &lineSegments, float scale);
+void undistortSegments(vector<vector<Point> > &lineSegments, const Mat &cameraMatrix, const Mat &distCoeffs);
+void undistortSegments(vector<Vec4f> &lineSegments, const Mat &cameraMatrix, const Mat &distCoeffs);
+
+#endif
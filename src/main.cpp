@@ -23,11 +23,15 @@
 #include "opencv2/highgui/highgui.hpp"
 #include "opencv2/imgproc/imgproc.hpp"
 
-#include "MSAC.h"
-
-#include "TopView.h"
-#include "geometry.h"
-#include "vanishingPoint.h"
+#include "ACCTVPSession.h"
+#include "Y4MReader.h"
+#include "batch.h"
+#include "calibTrack.h"
+#include "largeImage.h"
+#include "offline.h"
+#include "sink.h"
+#include "streams.h"
+#include "warp.h"
 
 using namespace std;
 using namespace cv;
@@ -38,11 +42,46 @@ void help(){
     << " | Usage: \n"
     << " |		-video		: Video file as input (Default: camera) \n"
     << " |		-image		: Image file as input (Default: camera) \n"
+    << " |		-raw		: YUV4MPEG2 (.y4m) or raw I420 file as input, memory-mapped without copies \n"
+    << " |		-streams	: File listing one input (video, .y4m or raw) per line, all processed at once without display \n"
+    << " |		-imageList	: File listing one image per line, all calibrated and warped on a thread pool without display\n"
+    << " |		-imageDir	: Same as -imageList for every image file of a directory\n"
+    << " |		-largeImage	: Binary PPM/PGM still image of any size, calibrated and warped tile by tile into -output (.ppm/.pgm)\n"
+    << " |		-memoryBudget	: Megabytes of image data -largeImage may hold at once (Default: 512)\n"
+    << " |		-outputDir	: Directory the -imageList / -imageDir top-view images are written to (same file names)\n"
+    << " |		-output		: With -still ON, splits the file in time ranges processed in parallel into this .y4m top-view video\n"
+    << " |		-chunks		: Time ranges of -output (Default: one per thread)\n"
+    << " |		-calibLog	: Per frame (-output) or per image (-imageList, -imageDir) calibration table (CSV)\n"
+    << " |		-writeCalib	: Writes the calibration of every frame (-video, -raw, -output) to this track file\n"
+    << " |		-replayCalib	: Takes the calibration of every frame from a -writeCalib track, no line detection\n"
+    << " |		-threads	: Threads shared by all -streams inputs (Default: one per core)\n"
+    << " |		-rawSize	: Frame size WxH of a headerless raw I420 file given to -raw \n"
     << " |		-still		: Camera doesn't change position, for a more stable projection \n"
+    << " |		-stillFrames	: Most frames of the -still calibration and of the -fixedFocal estimation (Default: 40)\n"
+    << " |		-stillTolerance	: Degrees, the -still calibration stops once the standard error of both vanishing points is lower, 0 for -stillFrames frames (Default: 0.05)\n"
+    << " |		-static		: Mean thumbnail difference (0-255) under which a frame keeps the last vanishing points without detection (Default: 0, off)\n"
+    << " |		-staticTop	: Same, under which a frame also keeps the last top-view without warping (Default: 0, off)\n"
     << " |		-manual		: Manual calibration of vanishing points \n"
     << " |		-play		: ON: the video runs until the end; OFF: frame by frame (key press event)\n"
+    << " |		-sink		: block: processing waits for the windows; latest: frames the windows can not keep up with are dropped (Default: latest for the camera, block otherwise)\n"
+    << " |		-previewWidth	: Width of the windows, 0 for the processing size (Default: 640)\n"
+    << " |		-overlay	: none (OFF), vps: vanishing points and axis, clusters: and their lines, lines (ON): and every line, drawn on the original preview (Default: lines)\n"
     << " |		-resizedWidth	: Width size (Height calculated based on aspect ratio)\n"
+    << " |		-yuv		: ON: asks the decoder for planar YUV 4:2:0 and detects on the luma plane (Default: OFF)\n"
+    << " |		-detectWidth	: Width of the image used for line detection, the top view keeps the processing size\n"
     << " |		-houghThreshold	: Threshold for finding lines. Bigger less lines, smaller more lines. (Default: 120)\n"
+    << " |		-detector	: hough: Canny + probabilistic Hough; edgel: gradient orientation grouping (Default: hough)\n"
+    << " |		-mergeSegments	: ON: fragments and duplicates of one edge are merged into one segment before the vanishing points are estimated (Default: ON)\n"
+    << " |		-tileThreshold	: Mean tile difference (0-255) above which a detection tile is detected again, the others keep their lines (Default: 0, whole image)\n"
+    << " |		-estimator	: greedy: one vanishing point after the other; joint: both as an orthogonal pair in one RANSAC (Default: greedy)\n"
+    << " |		-topSize	: Top-view size in pixels, WxH (Default: processing size)\n"
+    << " |		-gsd		: Top-view ground units per pixel, overrides -topSize\n"
+    << " |		-crop		: Ground region x0,y0,x1,y1 (-gsd units) the top view is cropped to, also set with two clicks on the Top View window\n"
+    << " |		-distortion	: Lens distortion coefficients k1,k2,p1,p2,k3 (Default: none)\n"
+    << " |		-distortionFocal: Focal length in input pixels the coefficients refer to (Default: input width)\n"
+    << " |		-fixedFocal	: ON: the focal length is estimated on the first frames and locked, then only the rotation is tracked (Default: OFF)\n"
+    << " |		-focal		: Known focal length in input pixels, locked from the first frame (implies -fixedFocal ON)\n"
+    << " |		-benchWarp	: Measures the top-view warp throughput at 1080p and 4K and exits\n"
     << " | Keys:\n"
     << " |		Esc: Quit\n"
     << " -------------------------------------------------------------------------\n"
@@ -70,32 +109,84 @@ void readPointsFile(string fileName, vector<Point2f> *points){
     }
 }
 
+//manual calibration on the display thread, the one that owns the windows
+class manualTask : public poolTask{
+public:
+    manualTask(mouseDataVP *data, detectionParams &params) : data(data), params(params){}
+    
+    virtual void run(){
+        vp = manualCalibration(data, params);
+    }
+    
+    Vec4f vp;
+    
+private:
+    mouseDataVP *data;
+    detectionParams &params;
+};
+
 /** Main function*/
 int main(int argc, char** argv)
 {
-    Vec2f Fu, Fv;
-    
-    cv::Mat inputImg, imgGRAY;
-    cv::Mat outputImg;
+    cv::Mat decodedImg;
     
     cv::VideoCapture video;
-    cv::Size procSize;
+    Y4MReader raw;
     
     char *videoFileName = 0;
     char *imageFileName = 0;
+    char *rawFileName = 0;
+    char *streamsFileName = 0;
+    char *outputFileName = 0;
+    char *imageListFileName = 0;
+    char *largeImageFileName = 0;
+    char *imageDirName = 0;
+    char *outputDirName = 0;
+    char *calibLogFileName = 0;
+    char *writeCalibFileName = 0;
+    char *replayCalibFileName = 0;
+    int numChunks = 0;
+    int memoryBudget = 512;
+    int numThreads = 0;
+    Size rawSize(-1, -1);
     
     int procWidth = -1;
-    int procHeight = -1;
-    int numVps = 2;
+    int detectWidth = -1;
     int numFramesCalib = 40;
+    float stillTolerance = 0.05f;
+    float staticThreshold = 0;
+    float staticTopThreshold = 0;
     int numFramesSmooth = 30;
-    int houghThreshold = 120;
+    
+    detectionParams detection;
+    detection.numVps = 2;
+    detection.houghThreshold = 120;
+    detection.detector = DETECTOR_HOUGH;
+    detection.estimator = ESTIMATOR_GREEDY;
+    detection.scale = 1;
+    detection.tileThreshold = 0;
+    detection.tiles = 0;
+    detection.shapes = 0;
+    detection.mergeSegments = true;
+    
+    Size topSize(-1, -1);
+    float gsd = 0;
+    Rect_<float> crop;
+    
+    Mat distCoeffs;
+    float distFocal = -1;
+    bool fixedFocal = false;
+    float focal = -1;
     
     bool useCamera = true;
     bool playMode = true;
     bool stillImage = false;
     bool stillVideo = false;
     bool manual = false;
+    int overlay = OVERLAY_LINES;
+    bool yuvInput = false;
+    int sinkPolicy = -1;
+    int previewWidth = SINK_PREVIEW_WIDTH;
     
     //variable to print a trajectory
     //vector<Point2f> trajectories;
@@ -117,9 +208,65 @@ int main(int argc, char** argv)
             stillImage = true;
             useCamera = false;
         }
+        else if(strcmp(s, "-raw") == 0){
+            // Input is a memory-mapped raw video file
+            rawFileName = argv[++i];
+            useCamera = false;
+        }
+        else if(strcmp(s, "-streams") == 0){
+            // Several inputs listed in a file
+            streamsFileName = argv[++i];
+            useCamera = false;
+        }
+        else if(strcmp(s, "-imageList") == 0){
+            // Image files listed in a file
+            imageListFileName = argv[++i];
+            useCamera = false;
+        }
+        else if(strcmp(s, "-imageDir") == 0){
+            // Every image file of a directory
+            imageDirName = argv[++i];
+            useCamera = false;
+        }
+        else if(strcmp(s, "-largeImage") == 0){
+            // Still image too large to be decoded at once
+            largeImageFileName = argv[++i];
+            useCamera = false;
+        }
+        else if(strcmp(s, "-memoryBudget") == 0){
+            memoryBudget = atoi(argv[++i]);
+        }
+        else if(strcmp(s, "-outputDir") == 0){
+            outputDirName = argv[++i];
+        }
+        else if(strcmp(s, "-output") == 0){
+            outputFileName = argv[++i];
+        }
+        else if(strcmp(s, "-chunks") == 0){
+            numChunks = atoi(argv[++i]);
+        }
+        else if(strcmp(s, "-calibLog") == 0){
+            calibLogFileName = argv[++i];
+        }
+        else if(strcmp(s, "-writeCalib") == 0){
+            writeCalibFileName = argv[++i];
+        }
+        else if(strcmp(s, "-replayCalib") == 0){
+            // Stored calibration, no detection
+            replayCalibFileName = argv[++i];
+        }
+        else if(strcmp(s, "-threads") == 0){
+            numThreads = atoi(argv[++i]);
+        }
+        else if(strcmp(s, "-rawSize") == 0){
+            sscanf(argv[++i], "%dx%d", &rawSize.width, &rawSize.height);
+        }
         else if(strcmp(s, "-resizedWidth") == 0){
             procWidth = atoi(argv[++i]);
         }
+        else if(strcmp(s, "-detectWidth") == 0){
+            detectWidth = atoi(argv[++i]);
+        }
         else if(strcmp(s, "-still" ) == 0){
             const char* ss = argv[++i];
             if(strcmp(ss, "ON") == 0 || strcmp(ss, "on") == 0
@@ -127,6 +274,18 @@ int main(int argc, char** argv)
                || strcmp(ss, "YES") == 0 || strcmp(ss, "yes") == 0 )
                 stillVideo = true;
         }
+        else if(strcmp(s, "-stillFrames") == 0){
+            numFramesCalib = atoi(argv[++i]);
+        }
+        else if(strcmp(s, "-stillTolerance") == 0){
+            stillTolerance = atof(argv[++i]);
+        }
+        else if(strcmp(s, "-static") == 0){
+            staticThreshold = atof(argv[++i]);
+        }
+        else if(strcmp(s, "-staticTop") == 0){
+            staticTopThreshold = atof(argv[++i]);
+        }
         else if(strcmp(s, "-manual" ) == 0){
             const char* ss = argv[++i];
             if(strcmp(ss, "ON") == 0 || strcmp(ss, "on") == 0
@@ -142,17 +301,199 @@ int main(int argc, char** argv)
                || strcmp(ss, "STEP") == 0 || strcmp(ss, "step") == 0)
                 playMode = false;
         }
+        else if(strcmp(s, "-overlay" ) == 0){
+            const char* ss = argv[++i];
+            if(strcmp(ss, "OFF") == 0 || strcmp(ss, "off") == 0
+               || strcmp(ss, "FALSE") == 0 || strcmp(ss, "false") == 0
+               || strcmp(ss, "NO") == 0 || strcmp(ss, "no") == 0
+               || strcmp(ss, "NONE") == 0 || strcmp(ss, "none") == 0)
+                overlay = OVERLAY_NONE;
+            else if(strcmp(ss, "VPS") == 0 || strcmp(ss, "vps") == 0)
+                overlay = OVERLAY_VPS;
+            else if(strcmp(ss, "CLUSTERS") == 0 || strcmp(ss, "clusters") == 0)
+                overlay = OVERLAY_CLUSTERS;
+            else
+                overlay = OVERLAY_LINES;
+        }
+        else if(strcmp(s, "-sink" ) == 0){
+            const char* ss = argv[++i];
+            if(strcmp(ss, "LATEST") == 0 || strcmp(ss, "latest") == 0)
+                sinkPolicy = SINK_LATEST;
+            else if(strcmp(ss, "BLOCK") == 0 || strcmp(ss, "block") == 0)
+                sinkPolicy = SINK_BLOCK;
+        }
+        else if(strcmp(s, "-previewWidth") == 0){
+            previewWidth = atoi(argv[++i]);
+        }
+        else if(strcmp(s, "-yuv" ) == 0){
+            const char* ss = argv[++i];
+            if(strcmp(ss, "ON") == 0 || strcmp(ss, "on") == 0
+               || strcmp(ss, "TRUE") == 0 || strcmp(ss, "true") == 0
+               || strcmp(ss, "YES") == 0 || strcmp(ss, "yes") == 0 )
+                yuvInput = true;
+        }
         else if(strcmp(s, "-houghThreshold") == 0){
-            houghThreshold = atoi(argv[++i]);
+            detection.houghThreshold = atoi(argv[++i]);
+        }
+        else if(strcmp(s, "-detector") == 0){
+            const char* ss = argv[++i];
+            if(strcmp(ss, "EDGEL") == 0 || strcmp(ss, "edgel") == 0)
+                detection.detector = DETECTOR_EDGEL;
+        }
+        else if(strcmp(s, "-mergeSegments" ) == 0){
+            const char* ss = argv[++i];
+            if(strcmp(ss, "OFF") == 0 || strcmp(ss, "off") == 0
+               || strcmp(ss, "FALSE") == 0 || strcmp(ss, "false") == 0
+               || strcmp(ss, "NO") == 0 || strcmp(ss, "no") == 0)
+                detection.mergeSegments = false;
+        }
+        else if(strcmp(s, "-tileThreshold") == 0){
+            detection.tileThreshold = atof(argv[++i]);
+        }
+        else if(strcmp(s, "-estimator") == 0){
+            const char* ss = argv[++i];
+            if(strcmp(ss, "JOINT") == 0 || strcmp(ss, "joint") == 0)
+                detection.estimator = ESTIMATOR_JOINT;
+        }
+        else if(strcmp(s, "-topSize") == 0){
+            sscanf(argv[++i], "%dx%d", &topSize.width, &topSize.height);
+        }
+        else if(strcmp(s, "-gsd") == 0){
+            gsd = atof(argv[++i]);
+        }
+        else if(strcmp(s, "-crop") == 0){
+            // Ground region x0,y0,x1,y1
+            Point2f a, b;
+            sscanf(argv[++i], "%f,%f,%f,%f", &a.x, &a.y, &b.x, &b.y);
+            crop = Rect_<float>(a, b);
+        }
+        else if(strcmp(s, "-distortion") == 0){
+            float k[5] = {0, 0, 0, 0, 0};
+            sscanf(argv[++i], "%f,%f,%f,%f,%f", &k[0], &k[1], &k[2], &k[3], &k[4]);
+            distCoeffs = Mat(1, 5, CV_32F, k).clone();
+        }
+        else if(strcmp(s, "-distortionFocal") == 0){
+            distFocal = atof(argv[++i]);
+        }
+        else if(strcmp(s, "-fixedFocal" ) == 0){
+            const char* ss = argv[++i];
+            if(strcmp(ss, "ON") == 0 || strcmp(ss, "on") == 0
+               || strcmp(ss, "TRUE") == 0 || strcmp(ss, "true") == 0
+               || strcmp(ss, "YES") == 0 || strcmp(ss, "yes") == 0 )
+                fixedFocal = true;
+        }
+        else if(strcmp(s, "-focal") == 0){
+            // Known focal length, locked from the first frame
+            focal = atof(argv[++i]);
+            fixedFocal = true;
+        }
+        else if(strcmp(s, "-benchWarp") == 0){
+            benchmarkWarp();
+            return 0;
         }
         else if(strcmp(s, "-help" ) == 0){
             help();
         }
     }
     
+    // Calibration and top-view session
+    sessionParams params = defaultSessionParams();
+    params.detection = detection;
+    params.procWidth = procWidth;
+    params.detectWidth = detectWidth;
+    params.still = stillVideo && !manual && !replayCalibFileName;
+    params.numFramesCalib = numFramesCalib;
+    params.stillTolerance = stillTolerance;
+    params.staticThreshold = staticThreshold;
+    params.staticTopThreshold = staticTopThreshold;
+    params.numFramesSmooth = numFramesSmooth;
+    params.fixedFocal = fixedFocal;
+    params.focal = focal;
+    params.topSize = topSize;
+    params.gsd = gsd;
+    params.crop = crop;
+    params.distCoeffs = distCoeffs;
+    params.distFocal = distFocal;
+    params.overlay = overlay;
+    params.topImage = true;
+    
+    // Several inputs on one shared thread pool, no display
+    if(streamsFileName){
+        vector<string> inputs = readInputList(streamsFileName);
+        if(inputs.empty()){
+            printf("ERROR: no inputs in %s\n", streamsFileName);
+            return -1;
+        }
+        
+        streamOptions options;
+        options.numThreads = numThreads;
+        options.rawSize = rawSize;
+        options.yuv = yuvInput;
+        
+        return runStreams(inputs, params, options);
+    }
+    
+    // Image batch on one thread pool, no display
+    if(imageListFileName || imageDirName){
+        vector<string> images = imageListFileName ? readInputList(imageListFileName) : listImages(imageDirName);
+        if(images.empty()){
+            printf("ERROR: no images in %s\n", imageListFileName ? imageListFileName : imageDirName);
+            return -1;
+        }
+        
+        batchOptions options;
+        options.numThreads = numThreads;
+        options.outputDir = outputDirName ? outputDirName : "";
+        options.calibLog = calibLogFileName ? calibLogFileName : "";
+        
+        return runImageBatch(images, params, options);
+    }
+    
+    // Very large still image, processed in tiles under a memory cap, no display
+    if(largeImageFileName){
+        if(!outputFileName){
+            printf("ERROR: -largeImage needs an -output image\n");
+            return -1;
+        }
+        
+        largeImageOptions options;
+        options.memoryBudget = (size_t)std::max(memoryBudget, 1) << 20;
+        options.overviewWidth = detectWidth;
+        options.topSize = topSize;
+        options.gsd = gsd;
+        options.crop = crop;
+        
+        return runLargeImage(largeImageFileName, outputFileName, detection, options);
+    }
+    
+    // Still camera file split in time ranges processed in parallel, no display
+    if(outputFileName){
+        char *input = rawFileName ? rawFileName : videoFileName;
+        if(!input || (!replayCalibFileName && (!stillVideo || manual))){
+            printf("ERROR: -output needs a -video or -raw file and -still ON or -replayCalib\n");
+            return -1;
+        }
+        
+        chunkOptions options;
+        options.numChunks = numChunks;
+        options.numThreads = numThreads;
+        options.rawSize = rawFileName ? rawSize : Size(-1, -1);
+        options.output = outputFileName;
+        options.calibLog = calibLogFileName ? calibLogFileName : "";
+        options.writeCalib = writeCalibFileName ? writeCalibFileName : "";
+        options.replayCalib = replayCalibFileName ? replayCalibFileName : "";
+        
+        return runChunks(input, params, options);
+    }
+    
     // Open video input
     if(useCamera)
         video.open(0);
+    else if(rawFileName){
+        bool opened = rawSize.width > 0 ? raw.open(rawFileName, rawSize) : raw.open(rawFileName);
+        if(!opened)
+            return -1;
+    }
     else{
         if(!stillImage)
             video.open(videoFileName);
@@ -160,12 +501,23 @@ int main(int argc, char** argv)
     
     // Check video input
     int width = 0, height = 0, fps = 0, fourcc = 0;
-    if(!stillImage){
+    if(rawFileName){
+        width = raw.frameSize().width;
+        height = raw.frameSize().height;
+        fps = (int)raw.fps();
+        
+        printf("Input raw video: (%d x %d) at %d fps, %d frames\n", width, height, fps, raw.numFrames());
+    }
+    else if(!stillImage){
         if( !video.isOpened() ){
             printf("ERROR: can not open camera or video file\n");
             return -1;
         }
         else{
+            // Raw decoder output, backends that ignore it keep delivering BGR
+            if(yuvInput)
+                video.set(CV_CAP_PROP_CONVERT_RGB, 0);
+            
             // Show video information
             width = (int) video.get(CV_CAP_PROP_FRAME_WIDTH);
             height = (int) video.get(CV_CAP_PROP_FRAME_HEIGHT);
@@ -179,187 +531,151 @@ int main(int argc, char** argv)
         }
     }
     else{
-        inputImg = cv::imread(imageFileName);
-        if(inputImg.empty())
+        decodedImg = cv::imread(imageFileName);
+        if(decodedImg.empty())
             return -1;
         
-        width = inputImg.cols;
-        height = inputImg.rows;
+        width = decodedImg.cols;
+        height = decodedImg.rows;
         
         printf("Input image: (%d x %d)\n", width, height);
         
         playMode = false;
     }
     
-    // Resize
-    if(procWidth != -1){
-        
-        procHeight = height*((double)procWidth/width);
-        procSize = cv::Size(procWidth, procHeight);
-        
-        printf("Resize to: (%d x %d)\n", procWidth, procHeight);
-    }
-    else
-        procSize = cv::Size(width, height);
-    
-    // Create and init MSAC
-    MSAC msac;
-    msac.init(procSize);
-    
-    //create mouse structs
+    //create mouse structs, the top-view window crop is handed to the session every frame
     mouseDataCrop mdCrop;
-    mdCrop.windowName = "Top View"; //topview window name
+    previewCrop preview;
+    preview.mouse.windowName = "Top View"; //topview window name
+    preview.mouse.ground = crop;
+    preview.ground = crop;
     mouseDataVP mdVP;
     mdVP.uDone = false;
     mdVP.clicked = false;
     
-    Vec4f previousVP;
-    Vec4f averageVP;
-    Vec4f vp;
-    vector<Vec4f> vpVector;
-    vector<Vec4f> stillVPS;
+    ACCTVPSession session(params, &mdCrop);
+    sessionResult result;
+    
+    //no detection or top-view before the vanishing points are clicked
+    if(manual && !replayCalibFileName)
+        session.setVanishingPoints(Vec4f(-1, -1, -1, -1));
+    
+    // Windows on their own thread, a camera drops frames the display can not keep up with
+    if(sinkPolicy < 0)
+        sinkPolicy = useCamera ? SINK_LATEST : SINK_BLOCK;
+    AsyncSink sink(SINK_QUEUE_SIZE, sinkPolicy, true);
     
-    bool averageCompleted = false;
+    // Calibration tracks, frames are indexed from the start of the input
+    CalibTrack writeTrack, replayTrack;
+    if(writeCalibFileName && !writeTrack.create(writeCalibFileName, Size(width, height)))
+        return -1;
+    if(replayCalibFileName){
+        if(!replayTrack.open(replayCalibFileName))
+            return -1;
+        if(replayTrack.frameSize() != Size(width, height)){
+            printf("ERROR: %s was written for another frame size\n", replayCalibFileName);
+            return -1;
+        }
+    }
     
     int frameNum=0;
+    int processedFrames = 0, skippedDetections = 0, reusedTopViews = 0;
     for(;;){
         
         if(!stillImage){
             frameNum++;
             
             //Get current image
-            video >> inputImg;
+            if(rawFileName)
+                raw.read(decodedImg);
+            else
+                video >> decodedImg;
         }
         
-        if(inputImg.empty())
+        if(decodedImg.empty())
             break;
         
-        //Resize to processing size
-        cv::resize(inputImg, inputImg, procSize);
+        frameBuffer frame = matFrameBuffer(decodedImg, Size(width, height));
+        bool i420 = frame.format == FRAME_I420;
         
-        //Color Conversion
-        if(inputImg.channels() == 3){
-            cv::cvtColor(inputImg, imgGRAY, CV_BGR2GRAY);
-            inputImg.copyTo(outputImg);
-        }
-        else{
-            inputImg.copyTo(imgGRAY);
-            cv::cvtColor(inputImg, outputImg, CV_GRAY2BGR);
-        }
+        int frameIndex = stillImage ? 0 : frameNum - 1;
         
-        ////////////////////////////
-        // Calculate VPs
-        ////////////////////////////
+        //manual calibration, on the processing size frame
+        if(manual && !replayTrack.isOpened() && frameNum == 3){
+            Mat bgr;
+            if(i420)
+                cv::cvtColor(decodedImg, bgr, CV_YUV2BGR_I420);
+            else if(decodedImg.channels() == 1)
+                cv::cvtColor(decodedImg, bgr, CV_GRAY2BGR);
+            else
+                bgr = decodedImg;
+            
+            //sizes and lens model as the session set them up on the previous frames
+            Size procSize = session.frame().size();
+            cv::resize(bgr, mdVP.image, procSize);
+            
+            detectionParams manualParams = session.detection();
+            manualTask task(&mdVP, manualParams);
+            sink.call(task);
+            session.setVanishingPoints(task.vp * ((float)width/procSize.width));
+        }
         
+        //stored calibration of the frame
+        if(replayTrack.isOpened())
+            session.setVanishingPoints(recordVanishingPoints(replayTrack.record(frameIndex)));
         
-        //manual calibration
-        if(manual && frameNum == 3){
-            mdVP.image = inputImg.clone();
-            vp = manualCalibration(&mdVP);
-        }
+        mdCrop.ground = previewGround(preview);
+        session.processFrame(frame, result);
         
-        //still video
-        else if(!manual && stillVideo){
-            //add vp to vector
-            if (frameNum < numFramesCalib && !averageCompleted) {
-                vp = automaticCalibration(msac, numVps, imgGRAY, outputImg, houghThreshold);
-                if (validVPS(vp))
-                    stillVPS.push_back(vp);
-            }
-            
-            //average vp, re-start video and zero frame num
-            else if(frameNum == numFramesCalib && !averageCompleted){
-                for (int i = 0; i < stillVPS.size(); i++) {
-                    vp += stillVPS[i];
-                }
-                vp /= (int)stillVPS.size();
-                
-                if (!useCamera) {
-                    video.open(videoFileName);
-                    frameNum = 0;
-                    averageCompleted = true;
-                    continue;
-                }
-            }
-        }
+        if(processedFrames == 0 && procWidth != -1)
+            printf("Resize to: (%d x %d)\n", session.frame().cols, session.frame().rows);
         
-        //automatic calibration
-        if (!manual && !stillVideo){
-            vp = automaticCalibration(msac, numVps, imgGRAY, outputImg, houghThreshold);
-            
-            //smooth vp position
-            if (vpVector.size() < numFramesSmooth)
-                vpVector.push_back(vp);
-            
-            else if(!stillVideo){
-                vpVector.erase(vpVector.begin());
-                vpVector.push_back(vp);
-                averageVP = Vec4f(0,0,0,0);
-                for (int i = 0; i < numFramesSmooth; i++) {
-                    averageVP += vpVector[i];
-                }
-                averageVP /= numFramesSmooth;
-                vp = averageVP;
-            }
-        }
+        if(result.stillCompleted)
+            printf("Still calibration done in %d frames\n", result.stillFrames);
         
-        //avoid vps to swap position
-        if (frameNum != 0 &&
-            pointDistance(Point2f(previousVP[0], previousVP[1]), Point2f(vp[0],vp[1])) > pointDistance(Point2f(previousVP[0], previousVP[1]), Point2f(vp[2],vp[3])) &&
-            pointDistance(Point2f(previousVP[2], previousVP[3]), Point2f(vp[2],vp[3])) > pointDistance(Point2f(previousVP[2], previousVP[3]), Point2f(vp[0],vp[1]))){
-            
-            Vec4f temp(vp);
-            vp[0] = vp[2];
-            vp[1] = vp[3];
-            vp[2] = temp[0];
-            vp[3] = temp[1];
-            
+        //still video: calibration done, re-start video and zero frame num
+        if(result.stillCompleted && !useCamera){
+            if (rawFileName)
+                raw.seek(0);
+            else
+                video.open(videoFileName);
+            frameNum = 0;
+            continue;
         }
         
-        previousVP = Vec4f(vp);
+        if(writeTrack.isOpened())
+            writeTrack.write(frameIndex, result);
         
-        ////////////////////////////
-        // Calculate Top-View
-        ////////////////////////////
+        processedFrames++;
+        skippedDetections += result.detectionSkipped;
+        reusedTopViews += result.topViewReused;
         
-        if (validVPS(vp)){
-            
-            Fu = Point2f(vp[0], vp[1]);
-            Fv = Point2f(vp[2], vp[3]);
-                        
-            TopView tv(inputImg, Fu, Fv, &mdCrop);
-            tv.drawAxis(outputImg, Point(0,0));
-            
-            tv.generateTopImage();
-            
-            //allows to crop top view
-            tv.cropTopView();
+        Ptr<TopView> tv;
+        if (result.valid){
+            tv = session.topView();
             
             // Example of scale use
-            // tv.setOrigin(Point(444,325));
-            // tv.setScaleFactor(Point(444,325), Point(505, 149), 5.0);
+            // tv->setOrigin(Point(444,325));
+            // tv->setScaleFactor(Point(444,325), Point(505, 149), 5.0);
     
-            //Point P = tv.toGroundPlaneCoord(Point(464, 268));
+            //Point P = tv->toGroundPlaneCoord(Point(464, 268));
             
             /*vector<Point2f> b;
-            b = tv.toTopViewCoordinates(trajectories);
+            b = tv->toTopViewCoordinates(trajectories);
             
             for (int k = 0; k < b.size(); k++){
-                circle(tv.topImage, b[k], 2, Scalar(255,0,0));
-                circle(outputImg, trajectories[k], 2, Scalar(255,0,0));
+                circle(tv->topImage, b[k], 2, Scalar(255,0,0));
+                circle(session.overlayImage(), trajectories[k], 2, Scalar(255,0,0));
             }*/
-            
-            imshow(mdCrop.windowName, tv.topImage);
         }
         
-        imshow("Original", outputImg);
+        //shown, cropped and drawn on by the display thread, the frame is copied at preview size
+        Mat original = previewImage(session.frame(), previewWidth);
+        previewTask *task = new previewTask(tv, original, &preview, previewWidth);
+        task->setOverlay(session.overlay(), overlay, (float)original.cols/session.frame().cols);
+        sink.push(task);
         
-        if(playMode)
-            cv::waitKey(1);
-        else
-            cv::waitKey(0);
-        
-        char q = (char)waitKey(1);
+        char q = (char)(playMode ? sink.key() : sink.waitKey());
         
         if( q == 27 ){
             printf("\nStopped by user request\n");
@@ -370,8 +686,16 @@ int main(int argc, char** argv)
             break;
     }
     
-    if(!stillImage)
+    if(sink.droppedTasks())
+        printf("%d preview frames dropped\n", sink.droppedTasks());
+    
+    if(skippedDetections || reusedTopViews)
+        printf("%d frames, unchanged: %d detections skipped, %d top-views reused\n", processedFrames, skippedDetections, reusedTopViews);
+    
+    if(rawFileName)
+        raw.release();
+    else if(!stillImage)
         video.release();
     
     return 0;
-}
\ No newline at end of file
+}
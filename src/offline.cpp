@@ -0,0 +1,340 @@
+//  Plane Projection
+//  offline.cpp
+//
+//  University of Bristol
+//
+//  Created by Henrique Grandinetti on 13/07/15.
+//  henriquegrandinetti@gmail.com
+
+#include "offline.h"
+#include "FrameSource.h"
+#include "calibTrack.h"
+#include "ThreadPool.h"
+
+#include "opencv2/imgproc/imgproc.hpp"
+
+#include <fstream>
+#include <sstream>
+#include <string.h>
+
+#ifndef WIN32
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#endif
+
+#define Y4M_FRAME_TAG   "FRAME\n"
+#define Y4M_TAG_BYTES   6
+
+typedef struct y4mOutput{
+    uchar *data;
+    size_t length;
+    size_t headerBytes;
+    size_t frameBytes;  //pixel data of one frame, without its tag
+    Size size;
+    bool mono;
+}y4mOutput;
+
+/* ----------------------------------------
+creates a YUV4MPEG2 file of numFrames frames
+and maps it, every frame has a fixed offset
+so that chunks write their frames in place.
+-------------------------------------------*/
+static bool createY4MOutput(const string &fileName, Size size, bool mono, double fps, int numFrames, y4mOutput &out){
+#ifdef WIN32
+    printf("ERROR: chunked output needs a POSIX system\n");
+    return false;
+#else
+    char header[128];
+    int rate = fps > 0 ? cvRound(fps*1000) : 25000;
+    sprintf(header, "YUV4MPEG2 W%d H%d F%d:1000 Ip A1:1 %s\n", size.width, size.height, rate, mono ? "Cmono" : "C420jpeg");
+
+    out.size = size;
+    out.mono = mono;
+    out.headerBytes = strlen(header);
+    out.frameBytes = mono ? (size_t)size.width*size.height : (size_t)size.width*size.height*3/2;
+    out.length = out.headerBytes + (size_t)numFrames*(Y4M_TAG_BYTES + out.frameBytes);
+
+    int fd = open(fileName.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0 || ftruncate(fd, out.length) != 0) {
+        if (fd >= 0)
+            close(fd);
+        printf("ERROR: can not create %s\n", fileName.c_str());
+        return false;
+    }
+
+    void *p = mmap(0, out.length, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+
+    if (p == MAP_FAILED) {
+        printf("ERROR: can not map %s\n", fileName.c_str());
+        return false;
+    }
+
+    out.data = (uchar *)p;
+    memcpy(out.data, header, out.headerBytes);
+    return true;
+#endif
+}
+
+//unmaps the output and cuts it after the frames that were written
+static void closeY4MOutput(const string &fileName, y4mOutput &out, int numFrames){
+#ifndef WIN32
+    munmap(out.data, out.length);
+    if (truncate(fileName.c_str(), out.headerBytes + (size_t)numFrames*(Y4M_TAG_BYTES + out.frameBytes)) != 0)
+        printf("ERROR: can not truncate %s\n", fileName.c_str());
+#endif
+    out.data = 0;
+}
+
+//one time range of the input, decoded, warped and written by one task
+class chunkTask : public poolTask{
+public:
+    chunkTask(const string &input, const sessionParams &params, const chunkOptions &options, Vec4f vps, Range frames, y4mOutput *out, CalibTrack *writeTrack, CalibTrack *replayTrack) :
+        frames(frames), input(input), options(options), params(params), vps(vps), out(out), writeTrack(writeTrack), replayTrack(replayTrack){
+        written = 0;
+        reusedTopViews = 0;
+        failure = 0;
+    }
+
+    virtual void run(){
+        FrameSource source;
+        if (!source.open(input, options.rawSize) || !source.seek(frames.start)) {
+            failure = "seeked to";
+            return;
+        }
+
+        ACCTVPSession session(params);
+        session.setVanishingPoints(vps);
+
+        Mat decodedImg, topBGR;
+
+        for (int i = frames.start; i < frames.end; i++) {
+            if (!source.read(decodedImg)) {
+                failure = "read";
+                break;
+            }
+
+            uchar *record = out->data + out->headerBytes + (size_t)i*(Y4M_TAG_BYTES + out->frameBytes);
+            memcpy(record, Y4M_FRAME_TAG, Y4M_TAG_BYTES);
+
+            //I420 and gray top-views are written straight into the output, BGR is converted
+            frameBuffer frame = matFrameBuffer(decodedImg, source.frameSize());
+            frameBuffer top;
+            top.width = out->size.width;
+            top.height = out->size.height;
+            top.format = out->mono ? FRAME_GRAY : FRAME_I420;
+            top.data = record + Y4M_TAG_BYTES;
+            top.stride = out->size.width;
+
+            //the undistorting warp gives BGR top-views for any input
+            bool convert = frame.format == FRAME_BGR || (frame.format == FRAME_I420 && !params.distCoeffs.empty());
+            if (convert) {
+                topBGR.create(out->size, CV_8UC3);
+                top.format = FRAME_BGR;
+                top.data = topBGR.data;
+                top.stride = topBGR.step;
+            }
+
+            //stored calibration of the frame, no detection
+            bool calibrated = true;
+            if (replayTrack) {
+                Vec4f stored = recordVanishingPoints(replayTrack->record(i));
+                calibrated = validVPS(stored);
+                session.setVanishingPoints(stored);
+            }
+
+            sessionResult result;
+            if (session.processFrame(frame, result, &top)) {
+                reusedTopViews += result.topViewReused;
+                if (convert) {
+                    Mat dst(out->size.height*3/2, out->size.width, CV_8UC1, record + Y4M_TAG_BYTES);
+                    cvtColor(topBGR, dst, CV_BGR2YUV_I420);
+                }
+
+                log << i << "," << result.vps[0] << "," << result.vps[1] << "," << result.vps[2] << "," << result.vps[3] << "," << result.focal << "\n";
+            }
+            else if (calibrated) {
+                failure = "processed";
+                break;
+            }
+            else {
+                //frames the track has no calibration for are black
+                memset(record + Y4M_TAG_BYTES, 0, (size_t)out->size.area());
+                memset(record + Y4M_TAG_BYTES + out->size.area(), 128, out->frameBytes - out->size.area());
+            }
+
+            if (writeTrack)
+                writeTrack->write(i, result);
+            written++;
+        }
+    }
+
+    Range frames;
+    int written;
+    int reusedTopViews;
+    const char *failure;    //what went wrong with frame frames.start + written, 0 if nothing
+    ostringstream log;
+
+private:
+    string input;
+    chunkOptions options;
+    sessionParams params;
+    Vec4f vps;
+    y4mOutput *out;
+    CalibTrack *writeTrack;
+    CalibTrack *replayTrack;
+};
+
+/* ----------------------------------------
+still camera offline run: the calibration is
+averaged over the first frames, or read per
+frame from a calibration track, then the input
+is split into time ranges that are decoded and
+warped in parallel into one output video.
+-------------------------------------------*/
+int runChunks(const string &input, const sessionParams &params, const chunkOptions &options){
+    FrameSource source;
+    if (!source.open(input, options.rawSize))
+        return -1;
+
+    int numFrames = source.numFrames();
+    if (numFrames <= 0) {
+        printf("ERROR: the number of frames of %s is unknown\n", input.c_str());
+        return -1;
+    }
+
+    CalibTrack replayTrack, writeTrack;
+    if (!options.replayCalib.empty()) {
+        if (!replayTrack.open(options.replayCalib))
+            return -1;
+        if (replayTrack.frameSize() != source.frameSize()) {
+            printf("ERROR: %s was written for another frame size\n", options.replayCalib.c_str());
+            return -1;
+        }
+    }
+    if (!options.writeCalib.empty() && !writeTrack.create(options.writeCalib, source.frameSize()))
+        return -1;
+
+    int64 start = getTickCount();
+
+    sessionParams calibParams = params;
+    calibParams.still = true;
+    calibParams.overlay = OVERLAY_NONE;
+    calibParams.topImage = false;
+    ACCTVPSession calibration(calibParams);
+
+    Mat decodedImg;
+    sessionResult result;
+    result.valid = false;
+    result.stillCompleted = false;
+    int format = FRAME_BGR;
+
+    //a replayed track sizes the output with its first calibrated frame
+    if (replayTrack.isOpened()) {
+        int first = 0;
+        while (first < replayTrack.numFrames() && !replayTrack.record(first)->valid)
+            first++;
+
+        const calibRecord *r = replayTrack.record(first);
+        if (r && source.seek(first) && source.read(decodedImg)) {
+            frameBuffer frame = matFrameBuffer(decodedImg, source.frameSize());
+            format = frame.format;
+
+            calibration.setVanishingPoints(recordVanishingPoints(r));
+            calibration.processFrame(frame, result);
+        }
+
+        if (!result.valid) {
+            printf("ERROR: no calibrated frame in %s\n", options.replayCalib.c_str());
+            return -1;
+        }
+    }
+
+    //still calibration on the first frames
+    else {
+        while (source.read(decodedImg)) {
+            frameBuffer frame = matFrameBuffer(decodedImg, source.frameSize());
+            format = frame.format;
+
+            calibration.processFrame(frame, result);
+            if (result.stillCompleted)
+                break;
+        }
+
+        if (!result.stillCompleted || !result.valid) {
+            printf("ERROR: no vanishing points found in the first %d frames\n", params.numFramesCalib);
+            return -1;
+        }
+
+        printf("Calibrated in %d frames: vps (%.1f, %.1f) (%.1f, %.1f), focal %.1f\n", result.stillFrames, result.vps[0], result.vps[1], result.vps[2], result.vps[3], result.focal);
+    }
+
+    //planar 4:2:0 output needs even sizes
+    bool mono = format == FRAME_GRAY;
+    Size size = result.topSize;
+    if (!mono)
+        size = Size(std::max(2, size.width & ~1), std::max(2, size.height & ~1));
+
+    y4mOutput out;
+    if (!createY4MOutput(options.output, size, mono, source.fps(), numFrames, out))
+        return -1;
+    source.release();
+
+    setNumThreads(1);
+    ThreadPool pool(options.numThreads);
+
+    int numChunks = options.numChunks > 0 ? options.numChunks : pool.numThreads();
+    numChunks = std::max(1, std::min(numChunks, numFrames));
+
+    sessionParams chunkParams = params;
+    chunkParams.still = false;
+    chunkParams.overlay = OVERLAY_NONE;
+
+    vector<chunkTask *> chunks;
+    for (int i = 0; i < numChunks; i++) {
+        Range frames((int)((int64)numFrames*i/numChunks), (int)((int64)numFrames*(i + 1)/numChunks));
+        chunks.push_back(new chunkTask(input, chunkParams, options, result.vps, frames, &out,
+                                       writeTrack.isOpened() ? &writeTrack : 0, replayTrack.isOpened() ? &replayTrack : 0));
+        pool.submit(chunks.back());
+    }
+    pool.wait();
+
+    //output ends at the first frame that failed, the frame count of a container may be too high for the last chunk
+    int written = 0, complete = 0, reused = 0;
+    bool failed = false;
+    while (complete < numChunks) {
+        chunkTask *chunk = chunks[complete++];
+        written += chunk->written;
+        reused += chunk->reusedTopViews;
+        if (chunk->written < chunk->frames.size()) {
+            int frame = chunk->frames.start + chunk->written;
+            if (complete == numChunks && strcmp(chunk->failure, "read") == 0)
+                printf("The input ended at frame %d of the %d announced\n", frame, numFrames);
+            else {
+                printf("ERROR: frame %d could not be %s, the output ends before it\n", frame, chunk->failure);
+                failed = true;
+            }
+            break;
+        }
+    }
+
+    closeY4MOutput(options.output, out, written);
+
+    if (!options.calibLog.empty()) {
+        ofstream log(options.calibLog.c_str());
+        log << "frame,u_x,u_y,v_x,v_y,focal\n";
+        for (int i = 0; i < complete; i++)
+            log << chunks[i]->log.str();
+    }
+
+    for (int i = 0; i < numChunks; i++)
+        delete chunks[i];
+
+    double seconds = (getTickCount() - start)/getTickFrequency();
+    printf("%d of %d frames in %d chunks, %.2f s, %.1f frames/s\n", written, numFrames, numChunks, seconds, written/std::max(seconds, 1e-9));
+    if (reused)
+        printf("%d unchanged frames reused the last top-view\n", reused);
+
+    return failed ? -1 : 0;
+}
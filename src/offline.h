@@ -0,0 +1,33 @@
+//  Plane Projection
+//  offline.h
+//
+//  University of Bristol
+//
+//  Created by Henrique Grandinetti on 13/07/15.
+//  henriquegrandinetti@gmail.com
+
+#ifndef __ACCTVP__offline__
+#define __ACCTVP__offline__
+
+#include <stdio.h>
+
+#include "opencv2/core/core.hpp"
+
+#include "ACCTVPSession.h"
+
+using namespace cv;
+using namespace std;
+
+typedef struct chunkOptions{
+    int numChunks;      //time ranges processed in parallel, 0 for one per core
+    int numThreads;     //pool size, 0 for one per core
+    Size rawSize;       //frame size of a headerless raw I420 input
+    string output;      //top-view video, YUV4MPEG2
+    string calibLog;    //per frame calibration table, none if empty
+    string writeCalib;  //per frame calibration track written, none if empty
+    string replayCalib; //calibration track used instead of the detection, none if empty
+}chunkOptions;
+
+int runChunks(const string &input, const sessionParams &params, const chunkOptions &options);
+
+#endif
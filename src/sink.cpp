@@ -0,0 +1,222 @@
+//  Plane Projection
+//  sink.cpp
+//
+//  University of Bristol
+//
+//  Created by Henrique Grandinetti on 13/07/15.
+//  henriquegrandinetti@gmail.com
+
+#include "sink.h"
+
+#include "opencv2/highgui/highgui.hpp"
+#include "opencv2/imgproc/imgproc.hpp"
+
+AsyncSink::AsyncSink(int capacity, int policy, bool gui) : capacity(std::max(1, capacity)), policy(policy), gui(gui){
+    callTask = 0;
+    busy = false;
+    stop = false;
+    lastKey = -1;
+    numKeys = 0;
+    dropped = 0;
+
+    thread = std::thread(&AsyncSink::loop, this);
+}
+
+//the queued tasks are run before the thread ends
+AsyncSink::~AsyncSink(){
+    {
+        std::lock_guard<std::mutex> lk(lock);
+        stop = true;
+    }
+    changed.notify_all();
+    thread.join();
+}
+
+void AsyncSink::push(poolTask *task){
+    std::unique_lock<std::mutex> lk(lock);
+
+    if (policy == SINK_LATEST) {
+        while ((int)queue.size() >= capacity) {
+            delete queue.front();
+            queue.pop_front();
+            dropped++;
+        }
+    }
+    else {
+        while ((int)queue.size() >= capacity)
+            changed.wait(lk);
+    }
+
+    queue.push_back(task);
+    changed.notify_all();
+}
+
+//runs a task on the sink thread and waits for it, e.g. to open a window of its own
+void AsyncSink::call(poolTask &task){
+    std::unique_lock<std::mutex> lk(lock);
+    while (callTask)
+        changed.wait(lk);
+
+    callTask = &task;
+    changed.notify_all();
+    while (callTask == &task)
+        changed.wait(lk);
+}
+
+//waits until every queued task ran
+void AsyncSink::flush(){
+    std::unique_lock<std::mutex> lk(lock);
+    while (!queue.empty() || busy)
+        changed.wait(lk);
+}
+
+//last key pressed on a window since the previous call, -1 for none
+int AsyncSink::key(){
+    std::lock_guard<std::mutex> lk(lock);
+    int k = lastKey;
+    lastKey = -1;
+    return k;
+}
+
+//waits for the next key pressed on a window, -1 without windows
+int AsyncSink::waitKey(){
+    if (!gui)
+        return -1;
+
+    std::unique_lock<std::mutex> lk(lock);
+    int count = numKeys;
+    while (numKeys == count)
+        changed.wait(lk);
+
+    int k = lastKey;
+    lastKey = -1;
+    return k;
+}
+
+//tasks dropped by SINK_LATEST
+int AsyncSink::droppedTasks(){
+    std::lock_guard<std::mutex> lk(lock);
+    return dropped;
+}
+
+void AsyncSink::pollKey(int delay){
+    int k = cv::waitKey(delay);
+    if (k < 0)
+        return;
+
+    std::lock_guard<std::mutex> lk(lock);
+    lastKey = k;
+    numKeys++;
+    changed.notify_all();
+}
+
+void AsyncSink::loop(){
+    std::unique_lock<std::mutex> lk(lock);
+
+    for (;;) {
+        if (callTask) {
+            poolTask *task = callTask;
+            lk.unlock();
+            task->run();
+            lk.lock();
+
+            callTask = 0;
+            changed.notify_all();
+        }
+        else if (!queue.empty()) {
+            poolTask *task = queue.front();
+            queue.pop_front();
+            busy = true;
+            changed.notify_all();
+            lk.unlock();
+
+            task->run();
+            delete task;
+
+            //windows are drawn while events are polled
+            if (gui)
+                pollKey(1);
+
+            lk.lock();
+            busy = false;
+            changed.notify_all();
+        }
+        else if (stop)
+            break;
+        else if (gui) {
+            lk.unlock();
+            pollKey(SINK_POLL_MS);
+            lk.lock();
+        }
+        else
+            changed.wait(lk);
+    }
+}
+
+//region set on the preview window, for the session of the next frame
+Rect_<float> previewGround(previewCrop &crop){
+    std::lock_guard<std::mutex> lk(crop.lock);
+    return crop.ground;
+}
+
+//copy of an image no wider than width, 0 for the full size. Never a view of img, which may change once given to the sink
+Mat previewImage(const Mat &img, int width){
+    Mat preview;
+    if (width <= 0 || img.cols <= width)
+        preview = img.clone();
+    else
+        resize(img, preview, Size(width, std::max(1, img.rows*width/img.cols)), 0, 0, INTER_AREA);
+
+    return preview;
+}
+
+//the top-image is copied here, on the processing thread, the original is already a copy
+previewTask::previewTask(const Ptr<TopView> &tv, const Mat &original, previewCrop *crop, int width) :
+    tv(tv), original(original), crop(crop), width(width), level(OVERLAY_NONE), scale(1){
+    topI420 = false;
+    if (tv.empty())
+        return;
+
+    //I420 is converted on the sink thread, its planes can not be resized as one image
+    topI420 = !tv->topImageI420.empty();
+    top = topI420 ? tv->topImageI420.clone() : previewImage(tv->topImage, width);
+}
+
+//overlay drawn on the original window, shapes in processing size pixels
+void previewTask::setOverlay(const overlayShapes &overlay, int overlayLevel, float overlayScale){
+    shapes = overlay;
+    level = overlayLevel;
+    scale = overlayScale;
+}
+
+void previewTask::run(){
+    if (!tv.empty()) {
+        if (topI420) {
+            Mat bgr;
+            cvtColor(top, bgr, CV_YUV2BGR_I420);
+            top = previewImage(bgr, width);
+        }
+
+        //clicks on the window set the crop of the next frames
+        tv->cropTopView(top, &crop->mouse);
+        {
+            std::lock_guard<std::mutex> lk(crop->lock);
+            crop->ground = crop->mouse.ground;
+        }
+
+        imshow(crop->mouse.windowName, top);
+    }
+
+    if (!original.empty()) {
+        if (level > OVERLAY_NONE) {
+            if (original.channels() == 1)
+                cvtColor(original, original, CV_GRAY2BGR);
+
+            drawOverlay(original, shapes, level, scale);
+            if (!tv.empty())
+                tv->drawAxis(original, Point(0,0), scale);
+        }
+
+        imshow("Original", original);
+    }
+}
@@ -0,0 +1,109 @@
+//  Plane Projection
+//  sink.h
+//
+//  University of Bristol
+//
+//  Created by Henrique Grandinetti on 13/07/15.
+//  henriquegrandinetti@gmail.com
+
+#ifndef __ACCTVP__sink__
+#define __ACCTVP__sink__
+
+#include <stdio.h>
+
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+
+#include "opencv2/core/core.hpp"
+
+#include "MSAC.h"
+#include "ThreadPool.h"
+#include "TopView.h"
+#include "vanishingPoint.h"
+
+using namespace cv;
+using namespace std;
+
+#define SINK_BLOCK          0       //push waits for room, every task runs (files)
+#define SINK_LATEST         1       //push drops the oldest waiting task, the sink keeps up with the latest one (live)
+
+#define SINK_QUEUE_SIZE     3       //tasks waiting at most
+#define SINK_POLL_MS        10      //window events are polled this often while idle
+#define SINK_PREVIEW_WIDTH  640     //width of the preview windows
+
+/* ----------------------------------------
+runs the outputs of the processing loop
+(windows, writers) on their own thread behind a
+bounded queue, so that rendering or encoding
+never holds the processing back. With gui set
+the thread owns the HighGUI windows and polls
+their events, keys are read from here. Tasks
+are deleted once run or dropped.
+-------------------------------------------*/
+class AsyncSink{
+public:
+    AsyncSink(int capacity, int policy, bool gui);
+    ~AsyncSink();
+
+    void push(poolTask *task);
+    void call(poolTask &task);
+    void flush();
+    int key();
+    int waitKey();
+    int droppedTasks();
+
+private:
+    deque<poolTask *> queue;
+    poolTask *callTask;     //caller-owned task call() waits for
+    bool busy;              //a queued task is running
+    bool stop;
+
+    std::mutex lock;
+    std::condition_variable changed;
+    std::thread thread;
+
+    int capacity;
+    int policy;
+    bool gui;
+    int lastKey, numKeys;
+    int dropped;
+
+    void loop();
+    void pollKey(int delay);
+};
+
+//crop of the top-view preview, clicked on the sink thread and taken by the processing thread
+typedef struct previewCrop{
+    mouseDataCrop mouse;    //sink thread only
+    std::mutex lock;
+    Rect_<float> ground;    //last region set on the window
+}previewCrop;
+
+Rect_<float> previewGround(previewCrop &crop);
+
+//top-view and frame windows of one processed frame
+class previewTask : public poolTask{
+public:
+    previewTask(const Ptr<TopView> &tv, const Mat &original, previewCrop *crop, int width);
+
+    void setOverlay(const overlayShapes &overlay, int overlayLevel, float overlayScale);
+    virtual void run();
+
+private:
+    Ptr<TopView> tv;
+    Mat top;        //copy of the top-image, the sink never reads the session's top-view images
+    bool topI420;
+    Mat original;
+    previewCrop *crop;
+    int width;
+
+    overlayShapes shapes;
+    int level;
+    float scale;    //original pixels per processing pixel
+};
+
+Mat previewImage(const Mat &img, int width);
+
+#endif
@@ -0,0 +1,132 @@
+//  Plane Projection
+//  streams.cpp
+//
+//  University of Bristol
+//
+//  Created by Henrique Grandinetti on 13/07/15.
+//  henriquegrandinetti@gmail.com
+
+#include "streams.h"
+#include "FrameSource.h"
+#include "ThreadPool.h"
+
+#include <fstream>
+
+/* ----------------------------------------
+one input with its own session (MSAC, smoothing,
+top-view, crop). A task processes one frame and
+queues itself again behind the other streams,
+so frames of a stream stay in order and every
+stream gets its turn.
+-------------------------------------------*/
+class streamTask : public poolTask{
+public:
+    streamTask(ThreadPool *pool, const string &input, const sessionParams &params, const streamOptions &options) : pool(pool), input(input), session(params, &crop){
+        frames = 0;
+        validFrames = 0;
+        skippedDetections = 0;
+        reusedTopViews = 0;
+        last.valid = false;
+
+        opened = source.open(input, options.rawSize, options.yuv);
+    }
+
+    virtual void run(){
+        if (!source.read(decodedImg))
+            return;
+
+        sessionResult result;
+        if (session.processFrame(matFrameBuffer(decodedImg, source.frameSize()), result)) {
+            validFrames++;
+            skippedDetections += result.detectionSkipped;
+            reusedTopViews += result.topViewReused;
+            last = result;
+        }
+        frames++;
+
+        pool->submit(this);
+    }
+
+    void report(){
+        printf("%s: %d frames, %d calibrated", input.c_str(), frames, validFrames);
+        if (skippedDetections || reusedTopViews)
+            printf(", unchanged: %d detections skipped, %d top-views reused", skippedDetections, reusedTopViews);
+        if (last.valid)
+            printf(", vps (%.1f, %.1f) (%.1f, %.1f), focal %.1f", last.vps[0], last.vps[1], last.vps[2], last.vps[3], last.focal);
+        printf("\n");
+    }
+
+    bool opened;
+    int frames;
+
+private:
+    ThreadPool *pool;
+    string input;
+
+    FrameSource source;
+    Mat decodedImg;
+
+    mouseDataCrop crop;
+    ACCTVPSession session;
+
+    int validFrames;
+    int skippedDetections, reusedTopViews;
+    sessionResult last;
+};
+
+//one input per line, empty lines and lines starting with # are skipped
+vector<string> readInputList(const string &fileName){
+    ifstream file(fileName.c_str());
+    vector<string> inputs;
+    string line;
+
+    while (getline(file, line)) {
+        while (!line.empty() && (line[line.size() - 1] == '\r' || line[line.size() - 1] == ' '))
+            line.erase(line.size() - 1);
+
+        if (!line.empty() && line[0] != '#')
+            inputs.push_back(line);
+    }
+
+    return inputs;
+}
+
+/* ----------------------------------------
+processes every input to the end on one
+shared pool. OpenCV's own threads are turned
+off so that there is one thread per core.
+-------------------------------------------*/
+int runStreams(const vector<string> &inputs, const sessionParams &params, const streamOptions &options){
+    sessionParams streamParams = params;
+    streamParams.overlay = OVERLAY_NONE;
+
+    setNumThreads(1);
+    ThreadPool pool(options.numThreads);
+
+    vector<streamTask *> streams;
+    for (size_t i = 0; i < inputs.size(); i++)
+        streams.push_back(new streamTask(&pool, inputs[i], streamParams, options));
+
+    printf("Processing %d streams on %d threads\n", (int)streams.size(), pool.numThreads());
+
+    int64 start = getTickCount();
+
+    for (size_t i = 0; i < streams.size(); i++) {
+        if (streams[i]->opened)
+            pool.submit(streams[i]);
+    }
+    pool.wait();
+
+    double seconds = (getTickCount() - start)/getTickFrequency();
+
+    int totalFrames = 0;
+    for (size_t i = 0; i < streams.size(); i++) {
+        streams[i]->report();
+        totalFrames += streams[i]->frames;
+        delete streams[i];
+    }
+
+    printf("%d frames in %.2f s, %.1f frames/s\n", totalFrames, seconds, totalFrames/std::max(seconds, 1e-9));
+
+    return 0;
+}
@@ -0,0 +1,30 @@
+//  Plane Projection
+//  streams.h
+//
+//  University of Bristol
+//
+//  Created by Henrique Grandinetti on 13/07/15.
+//  henriquegrandinetti@gmail.com
+
+#ifndef __ACCTVP__streams__
+#define __ACCTVP__streams__
+
+#include <stdio.h>
+
+#include "opencv2/core/core.hpp"
+
+#include "ACCTVPSession.h"
+
+using namespace cv;
+using namespace std;
+
+typedef struct streamOptions{
+    int numThreads;     //pool size, 0 for one per core
+    Size rawSize;       //frame size of headerless raw I420 inputs
+    bool yuv;           //asks video decoders for I420 frames
+}streamOptions;
+
+vector<string> readInputList(const string &fileName);
+int runStreams(const vector<string> &inputs, const sessionParams &params, const streamOptions &options);
+
+#endif
@@ -14,61 +14,51 @@
 
 #include "TopView.h"
 #include "geometry.h"
+#include "lineSegments.h"
 #include "vanishingPoint.h"
 
 #include <iostream>
 
-#define MAX_NUM_LINES	200
-
 using namespace std;
 
 //Originally written by Marcos Nieto
 /** This function contains the actions performed for each image*/
-Vec4f automaticCalibration(MSAC &msac, int numVps, cv::Mat &imgGRAY, cv::Mat &outputImg, int houghThreshold)
+Vec4f automaticCalibration(MSAC &msac, detectionParams &params, cv::Mat &imgGRAY, cv::Mat &outputImg)
 {
-    cv::Mat imgCanny;
-    
     //equalizeHist(imgGRAY, imgGRAY);
     
-    // Canny
-    cv::Canny(imgGRAY, imgCanny, 200, 120, 3);
-    
-    // Hough
     vector<vector<cv::Point> > lineSegments;
-    vector<cv::Point> aux;
     
-    vector<Vec4i> lines;
-    if(imgGRAY.cols*imgGRAY.rows < 400*400)
-        houghThreshold = houghThreshold * (float)2/3;
+    //only the tiles that changed since they were last detected
+    if(params.tiles && params.tileThreshold > 0)
+        tiledSegments(imgGRAY, params.detector == DETECTOR_EDGEL, params.houghThreshold, params.tileThreshold, *params.tiles, lineSegments);
+    else if(params.detector == DETECTOR_EDGEL)
+        edgelSegments(imgGRAY, lineSegments);
+    else
+        houghSegments(imgGRAY, params.houghThreshold, lineSegments);
     
-    cv::HoughLinesP(imgCanny, lines, 1, CV_PI/180, houghThreshold, 80, 60);
+    //fragments and duplicates of one edge become one segment, in detection image pixels
+    if(params.mergeSegments)
+        mergeCollinearSegments(lineSegments);
     
-    while(lines.size() > MAX_NUM_LINES)
-    {
-        lines.clear();
-        houghThreshold += 10;
-        cv::HoughLinesP(imgCanny, lines, 1, CV_PI/180, houghThreshold, 10, 10);
-    }
-    for(size_t i=0; i<lines.size(); i++)
+    //segments found on a downscaled image are taken back to frame coordinates,
+    //so the vanishing points come out in frame coordinates too
+    if(params.scale != 1)
+        scaleSegments(lineSegments, params.scale);
+    
+    if(params.shapes)
+        params.shapes->lines = lineSegments;
+    
+    if(!outputImg.empty())
     {
-        Point pt1, pt2;
-        pt1.x = lines[i][0];
-        pt1.y = lines[i][1];
-        pt2.x = lines[i][2];
-        pt2.y = lines[i][3];
-        line(outputImg, pt1, pt2, CV_RGB(0,0,0), 2);
-        /*circle(outputImg, pt1, 2, CV_RGB(255,255,255), CV_FILLED);
-         circle(outputImg, pt1, 3, CV_RGB(0,0,0),1);
-         circle(outputImg, pt2, 2, CV_RGB(255,255,255), CV_FILLED);
-         circle(outputImg, pt2, 3, CV_RGB(0,0,0),1);*/
-        
-        // Store into vector of pairs of Points for msac
-        aux.clear();
-        aux.push_back(pt1);
-        aux.push_back(pt2);
-        lineSegments.push_back(aux);
+        for(size_t i=0; i<lineSegments.size(); i++)
+            line(outputImg, lineSegments[i][0], lineSegments[i][1], CV_RGB(0,0,0), 2);
     }
     
+    //vanishing points are estimated in undistorted coordinates
+    if(!params.distCoeffs.empty())
+        undistortSegments(lineSegments, params.cameraMatrix, params.distCoeffs);
+    
     // Multiple vanishing points
     
     std::vector<cv::Mat> vps;			// vector of vps: vps[vpNum], with vpNum=0...numDetectedVps
@@ -78,7 +68,8 @@ Vec4f automaticCalibration(MSAC &msac, int numVps, cv::Mat &imgGRAY, cv::Mat &ou
     std::vector<std::vector<std::vector<cv::Point> > > lineSegmentsClusters;
     
     // Call msac function for multiple vanishing point estimation
-    msac.multipleVPEstimation(lineSegments, lineSegmentsClusters, numInliers, vps, numVps);
+    msac.setJoint(params.estimator == ESTIMATOR_JOINT);
+    msac.multipleVPEstimation(lineSegments, lineSegmentsClusters, numInliers, vps, params.numVps);
     for(int v=0; v<vps.size(); v++)
     {
         //printf("VP %d (%.3f, %.3f, %.3f)", v, vps[v].at<float>(0,0), vps[v].at<float>(1,0), vps[v].at<float>(2,0));
@@ -92,8 +83,12 @@ Vec4f automaticCalibration(MSAC &msac, int numVps, cv::Mat &imgGRAY, cv::Mat &ou
         //printf("\n");
     }
     
+    if(params.shapes)
+        params.shapes->clusters = lineSegmentsClusters;
+    
     // Draw line segments according to their cluster
-    msac.drawCS(outputImg, lineSegmentsClusters, vps);
+    if(!outputImg.empty())
+        msac.drawCS(outputImg, lineSegmentsClusters, vps);
     
     if (vps.size() >= 2)
         return Vec4f(vps[0].at<float>(0,0), vps[0].at<float>(1,0), vps[1].at<float>(0,0), vps[1].at<float>(1,0));
@@ -105,6 +100,43 @@ bool validVPS(Vec4f vps){
     return !(vps[0] == -1 && vps[1] == -1 && vps[2] == -1 && vps[3] == -1);
 }
 
+/* ----------------------------------------
+draws the overlay up to "level" on an image
+"scale" times the processing size, e.g. a
+preview, in the colours of MSAC::drawCS.
+-------------------------------------------*/
+void drawOverlay(Mat &img, const overlayShapes &shapes, int level, float scale){
+    Scalar colors[3] = {Scalar(0,0,255), Scalar(0,255,0), Scalar(255,0,0)};
+    
+    if(level >= OVERLAY_LINES)
+    {
+        for(size_t i=0; i<shapes.lines.size(); i++)
+            line(img, Point2f(shapes.lines[i][0])*scale, Point2f(shapes.lines[i][1])*scale, CV_RGB(0,0,0), 2);
+    }
+    
+    if(level >= OVERLAY_CLUSTERS)
+    {
+        for(size_t c=0; c<shapes.clusters.size() && c<3; c++)
+            for(size_t i=0; i<shapes.clusters[c].size(); i++)
+                line(img, Point2f(shapes.clusters[c][i][0])*scale, Point2f(shapes.clusters[c][i][1])*scale, colors[c], 1);
+    }
+    
+    if(level >= OVERLAY_VPS)
+    {
+        for(size_t v=0; v<shapes.vps.size() && v<3; v++)
+        {
+            Point2f vp = shapes.vps[v]*scale;
+            
+            // Paint vp if inside the image
+            if(vp.x >=0 && vp.x < img.cols && vp.y >=0 && vp.y < img.rows)
+            {
+                circle(img, vp, 4, colors[v], 2);
+                circle(img, vp, 3, CV_RGB(0,0,0), -1);
+            }
+        }
+    }
+}
+
 void mouseFunction(int event, int x, int y, int flags, void* userdata){
     mouseDataVP *data = (mouseDataVP *) userdata;
     Mat temp = data->image.clone();
@@ -150,7 +182,7 @@ void mouseFunction(int event, int x, int y, int flags, void* userdata){
     userdata = (void *) &data;
 }
 
-Vec4f manualCalibration(mouseDataVP *data){
+Vec4f manualCalibration(mouseDataVP *data, detectionParams &params){
     
     namedWindow("Manual Calibration");
     setMouseCallback("Manual Calibration", mouseFunction, (void *)data);
@@ -187,6 +219,11 @@ Vec4f manualCalibration(mouseDataVP *data){
     
     destroyWindow("Manual Calibration");
     
+    if (!params.distCoeffs.empty()) {
+        undistortSegments(data->fumanual, params.cameraMatrix, params.distCoeffs);
+        undistortSegments(data->fvmanual, params.cameraMatrix, params.distCoeffs);
+    }
+    
     Vec2f uvp = meanSegmentIntersections(data->fumanual);
     Vec2f vvp = meanSegmentIntersections(data->fvmanual);
     
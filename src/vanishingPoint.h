@@ -12,6 +12,39 @@
 #include <stdio.h>
 #include "opencv2/core/core.hpp"
 
+#include "lineSegments.h"
+
+#define DETECTOR_HOUGH	0
+#define DETECTOR_EDGEL	1
+
+#define ESTIMATOR_GREEDY	0
+#define ESTIMATOR_JOINT		1
+
+#define OVERLAY_NONE		0	//nothing is drawn, no copy of the frame is made
+#define OVERLAY_VPS		1	//vanishing points and world axis
+#define OVERLAY_CLUSTERS	2	//and the segments of each vanishing point
+#define OVERLAY_LINES		3	//and every detected segment
+
+//what the overlay draws, in processing size pixels, kept so that it can be drawn later at any size
+typedef struct overlayShapes{
+    vector<vector<Point> > lines;                   //every detected segment
+    vector<vector<vector<Point> > > clusters;       //segments of each vanishing point
+    vector<Point2f> vps;
+}overlayShapes;
+
+typedef struct detectionParams{
+    int numVps;
+    int houghThreshold;
+    int detector;   //DETECTOR_HOUGH or DETECTOR_EDGEL
+    int estimator;  //ESTIMATOR_GREEDY: one vp after the other; ESTIMATOR_JOINT: both as an orthogonal pair
+    Mat cameraMatrix, distCoeffs;   //lens distortion, empty if none
+    float scale;    //frame pixels per detection image pixel
+    float tileThreshold;    //mean absolute difference (0-255) above which a tile of a still camera is detected again, 0 for the whole image every time
+    segmentCache *tiles;    //segments kept between calls for tileThreshold, 0 for none
+    overlayShapes *shapes;  //gets the lines and clusters of each call, 0 for none
+    bool mergeSegments;     //collinear segments of one line are merged into one before MSAC
+} detectionParams;
+
 typedef struct mouseDataVP{
     bool clicked;
     bool uDone;
@@ -20,9 +53,10 @@ typedef struct mouseDataVP{
     Mat image;
 } mouseDataVP;
 
-Vec4f automaticCalibration(MSAC &msac, int numVps, cv::Mat &imgGRAY, cv::Mat &outputImg, int houghThreshold);
+Vec4f automaticCalibration(MSAC &msac, detectionParams &params, cv::Mat &imgGRAY, cv::Mat &outputImg);
 bool validVPS(Vec4f vps);
+void drawOverlay(Mat &img, const overlayShapes &shapes, int level, float scale);
 void mouseFunction(int event, int x, int y, int flags, void* userdata);
-Vec4f manualCalibration(mouseDataVP *data);
+Vec4f manualCalibration(mouseDataVP *data, detectionParams &params);
 
 #endif
\ No newline at end of file
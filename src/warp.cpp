@@ -0,0 +1,327 @@
+//  Plane Projection
+//  warp.cpp
+//
+//  University of Bristol
+//
+//  Created by Henrique Grandinetti on 13/07/15.
+//  henriquegrandinetti@gmail.com
+
+#include "warp.h"
+#include "ThreadPool.h"
+
+#include "opencv2/imgproc/imgproc.hpp"
+
+#include <string.h>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#define WARP_TILE_ROWS  32
+#define WARP_TILE_COLS  256
+#define WARP_FRAC_BITS  5       //sub-pixel bits, same as OpenCV INTER_BITS
+#define WARP_FRAC_SIZE  (1 << WARP_FRAC_BITS)
+
+/* ----------------------------------------
+fixed point source coordinates of n output
+pixels of a row, starting at the projective
+coordinates (X0, Y0, W0) and stepping by
+(dX, dY, dW) per pixel.
+-------------------------------------------*/
+static void warpCoords(double X0, double Y0, double W0, double dX, double dY, double dW, int n, int *xy){
+    int i = 0;
+
+#if defined(__SSE2__)
+    __m128 vX0 = _mm_set1_ps((float)X0), vdX = _mm_set1_ps((float)dX);
+    __m128 vY0 = _mm_set1_ps((float)Y0), vdY = _mm_set1_ps((float)dY);
+    __m128 vW0 = _mm_set1_ps((float)W0), vdW = _mm_set1_ps((float)dW);
+    __m128 scale = _mm_set1_ps((float)WARP_FRAC_SIZE);
+    __m128 four = _mm_set1_ps(4.0f);
+    __m128 idx = _mm_setr_ps(0.0f, 1.0f, 2.0f, 3.0f);
+
+    for (; i <= n - 4; i += 4) {
+        __m128 w = _mm_div_ps(scale, _mm_add_ps(vW0, _mm_mul_ps(vdW, idx)));
+        __m128i ix = _mm_cvtps_epi32(_mm_mul_ps(_mm_add_ps(vX0, _mm_mul_ps(vdX, idx)), w));
+        __m128i iy = _mm_cvtps_epi32(_mm_mul_ps(_mm_add_ps(vY0, _mm_mul_ps(vdY, idx)), w));
+
+        _mm_storeu_si128((__m128i *)(xy + 2*i), _mm_unpacklo_epi32(ix, iy));
+        _mm_storeu_si128((__m128i *)(xy + 2*i + 4), _mm_unpackhi_epi32(ix, iy));
+
+        idx = _mm_add_ps(idx, four);
+    }
+#endif
+
+    for (; i < n; i++) {
+        double w = W0 + dW*i;
+        w = w ? WARP_FRAC_SIZE/w : 0;
+        xy[2*i]     = saturate_cast<int>((X0 + dX*i)*w);
+        xy[2*i + 1] = saturate_cast<int>((Y0 + dY*i)*w);
+    }
+}
+
+//bilinear sample near the image border, pixels outside the source are black
+static inline void sampleBorder(const Mat &src, int cn, int X, int Y, uchar *out){
+    int sx = X >> WARP_FRAC_BITS, sy = Y >> WARP_FRAC_BITS;
+    int fx = X & (WARP_FRAC_SIZE - 1), fy = Y & (WARP_FRAC_SIZE - 1);
+    int w[4] = {(WARP_FRAC_SIZE - fx)*(WARP_FRAC_SIZE - fy), fx*(WARP_FRAC_SIZE - fy), (WARP_FRAC_SIZE - fx)*fy, fx*fy};
+
+    for (int c = 0; c < cn; c++)
+        out[c] = 0;
+
+    if (sx < -1 || sx >= src.cols || sy < -1 || sy >= src.rows)
+        return;
+
+    int sum[3] = {0, 0, 0};
+    for (int k = 0; k < 4; k++) {
+        int px = sx + (k & 1), py = sy + (k >> 1);
+        if (px < 0 || px >= src.cols || py < 0 || py >= src.rows)
+            continue;
+        const uchar *p = src.ptr<uchar>(py) + px*cn;
+        for (int c = 0; c < cn; c++)
+            sum[c] += p[c]*w[k];
+    }
+
+    for (int c = 0; c < cn; c++)
+        out[c] = (uchar)((sum[c] + (1 << (2*WARP_FRAC_BITS - 1))) >> (2*WARP_FRAC_BITS));
+}
+
+/* ----------------------------------------
+bilinear samples of n output pixels given
+their fixed point source coordinates.
+-------------------------------------------*/
+static void warpSampleRow(const Mat &src, int cn, const int *xy, int n, uchar *out){
+    const int round = 1 << (2*WARP_FRAC_BITS - 1);
+    size_t step = src.step;
+
+    //columns past maxX have 2x2 neighbourhoods that 4-byte loads would read beyond the row
+    unsigned maxX = (unsigned)(cn == 1 ? src.cols - 4 : src.cols - 2);
+    unsigned maxY = (unsigned)(src.rows - 1);
+
+    for (int i = 0; i < n; i++, out += cn) {
+        int X = xy[2*i], Y = xy[2*i + 1];
+        int sx = X >> WARP_FRAC_BITS, sy = Y >> WARP_FRAC_BITS;
+
+        if ((unsigned)sx >= maxX || (unsigned)sy >= maxY) {
+            sampleBorder(src, cn, X, Y, out);
+            continue;
+        }
+
+        int fx = X & (WARP_FRAC_SIZE - 1), fy = Y & (WARP_FRAC_SIZE - 1);
+        short w00 = (short)((WARP_FRAC_SIZE - fx)*(WARP_FRAC_SIZE - fy));
+        short w01 = (short)(fx*(WARP_FRAC_SIZE - fy));
+        short w10 = (short)((WARP_FRAC_SIZE - fx)*fy);
+        short w11 = (short)(fx*fy);
+
+        const uchar *p0 = src.data + sy*step + sx*cn;
+        const uchar *p1 = p0 + step;
+
+#if defined(__SSE2__)
+        //2x2 neighbourhood with channels interleaved column by column, one madd per row
+        int a0, b0, a1, b1;
+        memcpy(&a0, p0, 4); memcpy(&b0, p0 + cn, 4);
+        memcpy(&a1, p1, 4); memcpy(&b1, p1 + cn, 4);
+
+        __m128i z = _mm_setzero_si128();
+        __m128i r0 = _mm_unpacklo_epi8(_mm_unpacklo_epi8(_mm_cvtsi32_si128(a0), _mm_cvtsi32_si128(b0)), z);
+        __m128i r1 = _mm_unpacklo_epi8(_mm_unpacklo_epi8(_mm_cvtsi32_si128(a1), _mm_cvtsi32_si128(b1)), z);
+        __m128i s = _mm_add_epi32(_mm_madd_epi16(r0, _mm_setr_epi16(w00, w01, w00, w01, w00, w01, w00, w01)),
+                                  _mm_madd_epi16(r1, _mm_setr_epi16(w10, w11, w10, w11, w10, w11, w10, w11)));
+        s = _mm_srai_epi32(_mm_add_epi32(s, _mm_set1_epi32(round)), 2*WARP_FRAC_BITS);
+        s = _mm_packs_epi32(s, s);
+        s = _mm_packus_epi16(s, s);
+
+        int v = _mm_cvtsi128_si32(s);
+        if (cn == 1)
+            out[0] = (uchar)v;
+        else {
+            out[0] = (uchar)v;
+            out[1] = (uchar)(v >> 8);
+            out[2] = (uchar)(v >> 16);
+        }
+#else
+        for (int c = 0; c < cn; c++)
+            out[c] = (uchar)((p0[c]*w00 + p0[c + cn]*w01 + p1[c]*w10 + p1[c + cn]*w11 + round) >> (2*WARP_FRAC_BITS));
+#endif
+    }
+}
+
+class WarpTiles : public ParallelLoopBody{
+public:
+    WarpTiles(const Mat &src, Mat &dst, const double *M, const vector<Vec2i> *spans) : src(src), dst(dst), M(M), spans(spans){
+        tilesPerRow = (dst.cols + WARP_TILE_COLS - 1)/WARP_TILE_COLS;
+    }
+
+    virtual void operator()(const Range &range) const{
+        int xy[2*WARP_TILE_COLS];
+        int cn = src.channels();
+
+        for (int t = range.start; t < range.end; t++) {
+            int x0 = (t % tilesPerRow)*WARP_TILE_COLS;
+            int y0 = (t / tilesPerRow)*WARP_TILE_ROWS;
+            int x1 = std::min(x0 + WARP_TILE_COLS, dst.cols);
+            int y1 = std::min(y0 + WARP_TILE_ROWS, dst.rows);
+
+            //projective coordinates of the first pixel, incremented by the second column per row
+            double X = M[0]*x0 + M[1]*y0 + M[2];
+            double Y = M[3]*x0 + M[4]*y0 + M[5];
+            double W = M[6]*x0 + M[7]*y0 + M[8];
+
+            for (int y = y0; y < y1; y++, X += M[1], Y += M[4], W += M[7]) {
+                int xs = x0, xe = x1;
+                if (spans) {
+                    xs = std::max(x0, (*spans)[y][0]);
+                    xe = std::min(x1, (*spans)[y][1]);
+                    if (xs >= xe)
+                        continue;
+                }
+
+                int d = xs - x0;
+                warpCoords(X + M[0]*d, Y + M[3]*d, W + M[6]*d, M[0], M[3], M[6], xe - xs, xy);
+                warpSampleRow(src, cn, xy, xe - xs, dst.ptr<uchar>(y) + xs*cn);
+            }
+        }
+    }
+
+    int numTiles() const{
+        return tilesPerRow * ((dst.rows + WARP_TILE_ROWS - 1)/WARP_TILE_ROWS);
+    }
+
+private:
+    const Mat &src;
+    Mat &dst;
+    const double *M;
+    const vector<Vec2i> *spans;
+    int tilesPerRow;
+};
+
+/* ----------------------------------------
+same as warpPerspective with INTER_LINEAR and
+a black constant border, specialised for 8-bit
+1 and 3 channel images. Other types fall back
+to warpPerspective.
+If spans is given only the columns [start, end)
+of every output row are written, dst must then
+be allocated by the caller.
+-------------------------------------------*/
+void warpPerspectiveFast(const Mat &src, Mat &dst, const Mat &M, Size dsize, const vector<Vec2i> *spans){
+    if (src.depth() != CV_8U || (src.channels() != 1 && src.channels() != 3) || src.cols < 8 || src.data == dst.data) {
+        warpPerspective(src, dst, M, dsize);
+        return;
+    }
+
+    dst.create(dsize, src.type());
+
+    //inverse map, from output to source pixels
+    Mat Md;
+    M.convertTo(Md, CV_64F);
+    Mat Mi = Md.inv();
+
+    WarpTiles body(src, dst, Mi.ptr<double>(0), spans);
+    parallelFor(Range(0, body.numTiles()), body);
+}
+
+//sets every pixel outside the spans to value, e.g. before warpPerspectiveFast writes the spans of a reused image
+void clearOutsideSpans(Mat &dst, const vector<Vec2i> &spans, uchar value){
+    size_t pixel = dst.elemSize();
+
+    for (int y = 0; y < dst.rows; y++) {
+        int start = 0, end = 0;
+        if (y < (int)spans.size() && spans[y][1] > spans[y][0]) {
+            start = std::max(0, std::min(spans[y][0], dst.cols));
+            end = std::max(start, std::min(spans[y][1], dst.cols));
+        }
+
+        uchar *row = dst.ptr<uchar>(y);
+        memset(row, value, start*pixel);
+        memset(row + end*pixel, value, (dst.cols - end)*pixel);
+    }
+}
+
+/* ----------------------------------------
+remap tables that take every pixel of the
+spans of a warpPerspectiveFast output straight
+to the distorted source pixel. M maps the
+undistorted source to the output.
+-------------------------------------------*/
+void undistortWarpMaps(const Mat &M, Size dsize, const vector<Vec2i> &spans, const Mat &cameraMatrix, const Mat &distCoeffs, Mat &map1, Mat &map2){
+    Mat Md;
+    M.convertTo(Md, CV_64F);
+    Mat Mi = Md.inv();
+    const double *m = Mi.ptr<double>(0);
+    
+    Mat K, D;
+    cameraMatrix.convertTo(K, CV_64F);
+    distCoeffs.convertTo(D, CV_64F);
+    
+    double fx = K.at<double>(0,0), fy = K.at<double>(1,1);
+    double cx = K.at<double>(0,2), cy = K.at<double>(1,2);
+    
+    //k1, k2, p1, p2, k3
+    double k[5] = {0, 0, 0, 0, 0};
+    for (int i = 0; i < (int)D.total() && i < 5; i++)
+        k[i] = D.ptr<double>(0)[i];
+    
+    //pixels that are not written map outside the source and come out black
+    Mat map(dsize, CV_32FC2, Scalar::all(-1));
+    
+    for (int y = 0; y < dsize.height; y++) {
+        float *p = map.ptr<float>(y);
+        
+        for (int x = spans[y][0]; x < spans[y][1]; x++) {
+            //the spans keep the loop on the ground, W may have either sign there
+            double W = m[6]*x + m[7]*y + m[8];
+            if (W == 0)
+                continue;
+            
+            //normalised undistorted coordinates
+            double u = ((m[0]*x + m[1]*y + m[2])/W - cx)/fx;
+            double v = ((m[3]*x + m[4]*y + m[5])/W - cy)/fy;
+            
+            double r2 = u*u + v*v;
+            double radial = 1 + r2*(k[0] + r2*(k[1] + r2*k[4]));
+            double ud = u*radial + 2*k[2]*u*v + k[3]*(r2 + 2*u*u);
+            double vd = v*radial + k[2]*(r2 + 2*v*v) + 2*k[3]*u*v;
+            
+            p[2*x]     = (float)(ud*fx + cx);
+            p[2*x + 1] = (float)(vd*fy + cy);
+        }
+    }
+    
+    convertMaps(map, Mat(), map1, map2, CV_16SC2);
+}
+
+static void benchmarkWarpSize(Size size, int type){
+    Mat src(size, type), ref, out;
+    randu(src, Scalar::all(0), Scalar::all(255));
+
+    //oblique view of a ground plane, as produced by TopView
+    Point2f s[4] = {Point2f(size.width*0.35f, size.height*0.3f), Point2f(size.width*0.65f, size.height*0.3f),
+                    Point2f(0, (float)size.height), Point2f((float)size.width, (float)size.height)};
+    Point2f d[4] = {Point2f(0, 0), Point2f((float)size.width, 0),
+                    Point2f(size.width*0.3f, (float)size.height), Point2f(size.width*0.7f, (float)size.height)};
+    Mat M = getPerspectiveTransform(s, d);
+
+    int runs = 20;
+    double t0 = (double)getTickCount();
+    for (int i = 0; i < runs; i++)
+        warpPerspective(src, ref, M, size);
+    double t1 = (double)getTickCount();
+    for (int i = 0; i < runs; i++)
+        warpPerspectiveFast(src, out, M, size);
+    double t2 = (double)getTickCount();
+
+    double msRef = (t1 - t0)*1000/getTickFrequency()/runs;
+    double msFast = (t2 - t1)*1000/getTickFrequency()/runs;
+    double mpix = (double)size.area()/1e6;
+
+    printf("%dx%d %dch: warpPerspective %.2f ms (%.0f MPix/s), warpPerspectiveFast %.2f ms (%.0f MPix/s), max diff %.0f\n",
+           size.width, size.height, CV_MAT_CN(type), msRef, mpix*1000/msRef, msFast, mpix*1000/msFast, norm(ref, out, NORM_INF));
+}
+
+//throughput of warpPerspectiveFast against warpPerspective at 1080p and 4K
+void benchmarkWarp(){
+    benchmarkWarpSize(Size(1920, 1080), CV_8UC1);
+    benchmarkWarpSize(Size(1920, 1080), CV_8UC3);
+    benchmarkWarpSize(Size(3840, 2160), CV_8UC1);
+    benchmarkWarpSize(Size(3840, 2160), CV_8UC3);
+}
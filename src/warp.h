@@ -0,0 +1,24 @@
+//  Plane Projection
+//  warp.h
+//
+//  University of Bristol
+//
+//  Created by Henrique Grandinetti on 13/07/15.
+//  henriquegrandinetti@gmail.com
+
+#ifndef __ACCTVP__warp__
+#define __ACCTVP__warp__
+
+#include <stdio.h>
+
+#include "opencv2/core/core.hpp"
+
+using namespace cv;
+using namespace std;
+
+void warpPerspectiveFast(const Mat &src, Mat &dst, const Mat &M, Size dsize, const vector<Vec2i> *spans = 0);
+void clearOutsideSpans(Mat &dst, const vector<Vec2i> &spans, uchar value);
+void undistortWarpMaps(const Mat &M, Size dsize, const vector<Vec2i> &spans, const Mat &cameraMatrix, const Mat &distCoeffs, Mat &map1, Mat &map2);
+void benchmarkWarp();
+
+#endif